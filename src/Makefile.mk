@@ -4,20 +4,37 @@ AR = ar
 CCFLAGS = -I${BOOST_DIR} -g
 LDFLAGS =
 
-OBJS = ZooKeeper.o
+OBJS = ZooKeeper.o ZkUtil.o ZkServerSelector.o ZkTree.o ZkShardGroup.o ZkDoubleBarrier.o
 LIB = libcppzk.a
+# single-threaded version, for event loop integration, link with zookeeper_st
+ST_OBJS = ZooKeeperLoop.o ZkUtil.o
+ST_LIB = libcppzk_st.a
 
-all: ${LIB} test
+all: ${LIB} ${ST_LIB} test test_st bench
 
 %.o:%.cc %.h
 	${CC} -o $@ -c $< ${CCFLAGS} 
+# exportTree/importTree of ZooKeeper
+ZkTree.o: ZkTree.cc ZooKeeper.h
+	${CC} -o $@ -c $< ${CCFLAGS} 
 
 ${LIB}:${OBJS}
 	${AR} rv $@ ${OBJS} 
 
+${ST_LIB}:${ST_OBJS}
+	${AR} rv $@ ${ST_OBJS} 
+
 test.o: test.cc
 	${CC} -o $@ -c $< ${CCFLAGS} 
 test: test.o 
 	${CC} -o test test.o -lcppzk -lzookeeper_mt -pthread  ${CCFLAGS} -L.
+bench.o: bench.cc
+	${CC} -o $@ -c $< ${CCFLAGS} 
+bench: bench.o 
+	${CC} -o bench bench.o -lcppzk -lzookeeper_mt -pthread  ${CCFLAGS} -L.
+test_st.o: test_st.cc
+	${CC} -o $@ -c $< ${CCFLAGS} 
+test_st: test_st.o 
+	${CC} -o test_st test_st.o -lcppzk_st -lzookeeper_st ${CCFLAGS} -L.
 clean:
-	rm -f ${OBJS} ${LIB} *.o
\ No newline at end of file
+	rm -f ${OBJS} ${ST_OBJS} ${LIB} ${ST_LIB} *.o
@@ -0,0 +1,145 @@
+#ifndef _ZK_CONFIG_H_
+#define _ZK_CONFIG_H_
+
+#include <boost/bind.hpp>
+#include <boost/atomic.hpp>
+#include "ZooKeeper.h"
+
+// class ZkConfig, a typed configuration kept up to date by watchData.
+// every new value of the node is parsed once, in the zookeeper thread, and published as an immutable snapshot.
+// usage:
+//     bool parseLimits(const std::string &value, Limits &limits);
+//     ZkConfig<Limits> limits(&parseLimits);
+//     limits.init(zk, "/config/limits"); // the first value is parsed before it returns, it fails if it's malformed
+//     // in each request thread
+//     ZkConfig<Limits>::Reader reader(limits);
+//     reader.get()->maxConnections;      // one atomic load if unchanged, no lock
+// thread safety: ZkConfig can be used from any thread, a Reader by one thread at a time.
+// an old snapshot is freed when the last reader holding it moves to a newer one.
+template<class T>
+class ZkConfig : public boost::noncopyable
+{
+	struct Core;
+public:
+	typedef boost::shared_ptr<const T> Snapshot;
+	// return false if the value is malformed, the current snapshot is kept then
+	typedef boost::function<bool (const std::string &value, T &out)> Parser;
+	//
+	class Reader
+	{
+	public:
+		explicit Reader(const ZkConfig &config) : core_ (config.core_), version_ (0) {}
+		// the latest snapshot, null if none is published yet
+		const Snapshot &get()
+		{
+			long version = core_->version.load(boost::memory_order_acquire);
+			if(version != version_)
+			{
+				core_->load(snapshot_, version_);
+			}
+			return snapshot_;
+		}
+	private:
+		boost::shared_ptr<Core> core_;
+		Snapshot snapshot_;
+		long version_;
+	};
+	//
+	explicit ZkConfig(const Parser &parser) : core_ (new Core(parser)), zk_ (NULL), id_ (0) {}
+	~ZkConfig()
+	{
+		if(zk_)
+		{
+			zk_->unwatchData(path_, id_);
+		}
+	}
+	// read and parse the node, then watch it. the watch options can coalesce frequent changes.
+	// ZBADARGUMENTS if the first value is rejected by the parser, the node is not watched then
+	ZkRet init(ZooKeeper &zk, const std::string &path, const ZooKeeper::WatchOptions &options = ZooKeeper::WatchOptions())
+	{
+		std::string value;
+		ZkRet zr = zk.getData(path, value);
+		if(!zr)
+		{
+			return zr;
+		}
+		Core::update(core_, path, value);
+		if(0 == version())
+		{
+			return ZkRet(ZBADARGUMENTS);
+		}
+		zr = zk.watchData(path, boost::bind(&Core::update, core_, _1, _2), &id_, options);
+		if(zr)
+		{
+			zk_ = &zk;
+			path_ = path;
+		}
+		return zr;
+	}
+	// the latest snapshot, it locks, use a Reader on hot paths
+	Snapshot get() const
+	{
+		Snapshot snapshot;
+		long version;
+		core_->load(snapshot, version);
+		return snapshot;
+	}
+	// number of snapshots published
+	long version() const {return core_->version.load(boost::memory_order_acquire); }
+	// number of values the parser rejected
+	unsigned long parseFailures() const
+	{
+		ZkMutex::Guard guard(core_->mutex);
+		return core_->failures;
+	}
+private:
+	// shared with the watch callback, which may still run after ZkConfig is destroyed
+	struct Core
+	{
+		explicit Core(const Parser &p) : parser (p), version (0), failures (0) {}
+		static void update(const boost::shared_ptr<Core> &core, const std::string &path, const std::string &value)
+		{
+			{
+				ZkMutex::Guard guard(core->mutex);
+				// the same value is delivered again when the watch is renewed
+				if(core->current && value == core->raw)
+				{
+					return;
+				}
+			}
+			// parse out of the lock, only the zookeeper thread publishes
+			boost::shared_ptr<T> parsed(new T());
+			bool ok = core->parser(value, *parsed);
+			ZkMutex::Guard guard(core->mutex);
+			if(ok)
+			{
+				core->current = parsed;
+				core->raw = value;
+				core->version.fetch_add(1, boost::memory_order_release);
+			}
+			else
+			{
+				++core->failures;
+			}
+		}
+		void load(Snapshot &snapshot, long &ver)
+		{
+			ZkMutex::Guard guard(mutex);
+			snapshot = current;
+			ver = version.load(boost::memory_order_relaxed);
+		}
+		Parser parser;
+		ZkMutex mutex;
+		Snapshot current;
+		std::string raw;
+		// bumped after current is replaced, readers check it without the lock
+		boost::atomic<long> version;
+		unsigned long failures;
+	};
+	boost::shared_ptr<Core> core_;
+	ZooKeeper *zk_;
+	std::string path_;
+	ZooKeeper::WatchId id_;
+};
+
+#endif
@@ -0,0 +1,224 @@
+#include <stdlib.h>
+#include <boost/bind.hpp>
+#include "ZkDoubleBarrier.h"
+#include "ZkUtil.h"
+
+using namespace std;
+
+#define ZK_BARRIER_ENTERED "entered"
+#define ZK_BARRIER_LEFT "left"
+
+static const char *phaseDir(int phase)
+{
+	return 0 == phase ? "/enter" : "/leave";
+}
+
+ZkDoubleBarrier::ZkDoubleBarrier(ZooKeeper &zk, const std::string &path, size_t count)
+	: zk_ (zk)
+	, path_ (path)
+	, count_ (count)
+	, core_ (new Core)
+	, inited_ (false)
+	, watchId_ (0)
+{
+
+}
+
+ZkDoubleBarrier::~ZkDoubleBarrier()
+{
+	if(inited_)
+	{
+		zk_.unwatchData(path_ + "/ready", watchId_);
+	}
+}
+
+ZkRet ZkDoubleBarrier::enter(int timeout/*=-1*/)
+{
+	ZkRet zr = init();
+	if(!zr)
+	{
+		return zr;
+	}
+	zr = arrive(ENTER);
+	if(!zr)
+	{
+		return zr;
+	}
+	return waitFor(ENTER, timeout);
+}
+
+ZkRet ZkDoubleBarrier::leave(int timeout/*=-1*/)
+{
+	ZkRet zr = init();
+	if(!zr)
+	{
+		return zr;
+	}
+	zr = arrive(LEAVE);
+	if(!zr)
+	{
+		return zr;
+	}
+	zr = waitFor(LEAVE, timeout);
+	if(!zr)
+	{
+		return zr;
+	}
+	// the barrier is over, clean up one arrival and one departure of this process
+	ZkMutex::Guard guard(mutex_);
+	for(int phase = ENTER; phase <= LEAVE; ++phase)
+	{
+		vector<string> &nodes = batches_[phase].nodes;
+		if(!nodes.empty())
+		{
+			zk_.deleteNodeQueued(nodes.back());
+			nodes.pop_back();
+		}
+	}
+	return zr;
+}
+
+ZkRet ZkDoubleBarrier::init()
+{
+	{
+		ZkMutex::Guard guard(mutex_);
+		if(inited_)
+		{
+			return ZkRet(ZOK);
+		}
+	}
+	const char *nodes[] = {"/enter", "/leave", "/ready"};
+	for(size_t i = 0; i < sizeof(nodes) / sizeof(nodes[0]); ++i)
+	{
+		ZkRet zr = zk_.createNode(path_ + nodes[i], "", true);
+		if(!zr && !zr.nodeExist())
+		{
+			return zr;
+		}
+	}
+	// the current value is delivered by the first read of the watch, or in this thread
+	// if the path is watched already, so out of the lock
+	ZooKeeper::WatchId id = 0;
+	ZkRet zr = zk_.watchData(path_ + "/ready", boost::bind(&Core::onReady, core_, _1, _2), &id);
+	if(!zr)
+	{
+		return zr;
+	}
+	bool inited = false;
+	{
+		ZkMutex::Guard guard(mutex_);
+		inited = inited_;
+		if(!inited_)
+		{
+			inited_ = true;
+			watchId_ = id;
+		}
+	}
+	if(inited)
+	{
+		// inited by another thread meanwhile
+		zk_.unwatchData(path_ + "/ready", id);
+	}
+	return zr;
+}
+
+// group commit: the first party sends the arrivals pending, the parties coming meanwhile go in the next batch
+ZkRet ZkDoubleBarrier::arrive(Phase phase)
+{
+	Batches &b = batches_[phase];
+	mutex_.lock();
+	unsigned long batch = b.next;
+	++b.pending;
+	while(b.done < batch)
+	{
+		if(b.sending)
+		{
+			cond_.wait(mutex_);
+			continue;
+		}
+		b.sending = true;
+		unsigned long id = b.next++;
+		size_t n = b.pending;
+		b.pending = 0;
+		mutex_.unlock();
+		vector<string> paths;
+		ZkRet zr = sendBatch(phase, n, paths);
+		mutex_.lock();
+		b.nodes.insert(b.nodes.end(), paths.begin(), paths.end());
+		b.results[id] = make_pair(zr.code(), n);
+		b.done = id;
+		b.sending = false;
+		cond_.notifyAll();
+	}
+	map<unsigned long, pair<int, size_t> >::iterator it = b.results.find(batch);
+	int rc = it->second.first;
+	if(0 == --it->second.second)
+	{
+		b.results.erase(it);
+	}
+	mutex_.unlock();
+	return ZkRet(rc);
+}
+
+ZkRet ZkDoubleBarrier::sendBatch(Phase phase, size_t n, std::vector<std::string> &paths)
+{
+	string dir = path_ + phaseDir(phase);
+	string prefix = dir + "/p-";
+	ZkRet zr = zk_.createSequenceEphemeralNodes(prefix, "", n, paths);
+	if(!zr)
+	{
+		LOG_ERROR(("barrier arrival failed, path=%s, parties=%lu", dir.c_str(), (unsigned long)n));
+		return zr;
+	}
+	unsigned long maxSeq = 0;
+	for(size_t i = 0; i < paths.size(); ++i)
+	{
+		unsigned long seq = strtoul(paths[i].c_str() + prefix.length(), NULL, 10);
+		maxSeq = max(maxSeq, seq);
+	}
+	// the parent's sequence counts every arrival, only the last ones look at the children
+	if(maxSeq + 1 < count_)
+	{
+		return ZkRet(ZOK);
+	}
+	vector<string> children;
+	zr = zk_.getChildren(dir, children);
+	if(!zr)
+	{
+		return zr;
+	}
+	if(children.size() >= count_)
+	{
+		LOG_DEBUG(("barrier %s, %lu parties, %s", path_.c_str(), (unsigned long)children.size(), ENTER == phase ? ZK_BARRIER_ENTERED : ZK_BARRIER_LEFT));
+		return zk_.setData(path_ + "/ready", ENTER == phase ? ZK_BARRIER_ENTERED : ZK_BARRIER_LEFT);
+	}
+	return ZkRet(ZOK);
+}
+
+ZkRet ZkDoubleBarrier::waitFor(Phase phase, int timeout)
+{
+	long long deadline = nowMicros() + timeout * 1000LL;
+	ZkMutex::Guard guard(core_->mutex);
+	while(!(ZK_BARRIER_LEFT == core_->state || (ENTER == phase && ZK_BARRIER_ENTERED == core_->state)))
+	{
+		if(timeout < 0)
+		{
+			core_->cond.wait(core_->mutex);
+			continue;
+		}
+		long long left = deadline - nowMicros();
+		if(left <= 0)
+		{
+			return ZkRet(ZOPERATIONTIMEOUT);
+		}
+		core_->cond.wait(core_->mutex, static_cast<int>((left + 999) / 1000));
+	}
+	return ZkRet(ZOK);
+}
+
+void ZkDoubleBarrier::Core::onReady(const boost::shared_ptr<Core> &core, const std::string &path, const std::string &value)
+{
+	ZkMutex::Guard guard(core->mutex);
+	core->state = value;
+	core->cond.notifyAll();
+}
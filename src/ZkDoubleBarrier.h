@@ -0,0 +1,67 @@
+#ifndef _ZK_DOUBLE_BARRIER_H_
+#define _ZK_DOUBLE_BARRIER_H_
+
+#include "ZooKeeper.h"
+
+// class ZkDoubleBarrier, count parties enter a phase together, and leave it together.
+// znodes under path:
+//     ready          "", "entered" or "left", the only node waiters watch, so each of them wakes once per state
+//     enter/p-<seq>  ephemeral sequence node of each arrival
+//     leave/p-<seq>  ephemeral sequence node of each departure
+// only an arrival whose sequence number reaches count reads the children to check the count, then flips ready.
+// the threads of a process can share one ZkDoubleBarrier, arrivals that come while a batch is being sent
+// go together in the next zoo_multi.
+// usage:
+//     ZkDoubleBarrier barrier(zk, "/job/phase-3", 2000); // a new path for each phase
+//     barrier.enter();
+//     ... work of the phase
+//     barrier.leave();
+class ZkDoubleBarrier : public boost::noncopyable
+{
+public:
+	ZkDoubleBarrier(ZooKeeper &zk, const std::string &path, size_t count);
+	~ZkDoubleBarrier();
+	// block until count parties have entered, timeout in milisecond, -1 for ever.
+	// a timed out party stays entered.
+	ZkRet enter(int timeout = -1);
+	// block until count parties have left
+	ZkRet leave(int timeout = -1);
+private:
+	enum Phase {ENTER, LEAVE};
+	ZkRet init();
+	ZkRet arrive(Phase phase);
+	ZkRet sendBatch(Phase phase, size_t n, std::vector<std::string> &paths);
+	ZkRet waitFor(Phase phase, int timeout);
+	// the state of ready, shared with the watch callback, which may still run after the barrier is destroyed
+	struct Core
+	{
+		static void onReady(const boost::shared_ptr<Core> &core, const std::string &path, const std::string &value);
+		ZkMutex mutex;
+		ZkCondition cond;
+		std::string state;
+	};
+	//
+	ZooKeeper &zk_;
+	std::string path_;
+	size_t count_;
+	boost::shared_ptr<Core> core_;
+	// guards inited_, watchId_ and batches_
+	ZkMutex mutex_;
+	ZkCondition cond_;
+	bool inited_;
+	ZooKeeper::WatchId watchId_;
+	// batches of each phase
+	struct Batches
+	{
+		Batches() : pending (0), sending (false), next (1), done (0) {}
+		size_t pending;
+		bool sending;
+		unsigned long next;
+		unsigned long done;
+		std::map<unsigned long, std::pair<int, size_t> > results; // rc and number of parties not told yet
+		std::vector<std::string> nodes;
+	};
+	Batches batches_[2];
+};
+
+#endif
@@ -0,0 +1,471 @@
+#ifdef WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <netdb.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <poll.h>
+#endif
+#include <string.h>
+#include <algorithm>
+#include "ZkServerSelector.h"
+#include "ZkUtil.h"
+
+using namespace std;
+
+#ifdef WIN32
+typedef SOCKET SocketType;
+#define closeSocket closesocket
+#define pollSockets WSAPoll
+#else
+typedef int SocketType;
+#define INVALID_SOCKET (-1)
+#define closeSocket close
+#define pollSockets poll
+#endif
+
+static bool setNonBlocking(SocketType fd)
+{
+#ifdef WIN32
+	u_long mode = 1;
+	return 0 == ioctlsocket(fd, FIONBIO, &mode);
+#else
+	int flags = fcntl(fd, F_GETFL, 0);
+	return flags >= 0 && 0 == fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+#endif
+}
+
+static bool connectPending()
+{
+#ifdef WIN32
+	return WSAEWOULDBLOCK == WSAGetLastError();
+#else
+	return EINPROGRESS == errno;
+#endif
+}
+
+// "ip:port", ipv6 in brackets as in connect strings: "[ip]:port", whether it's given with brackets or not
+static std::string normalizeAddress(const std::string &address)
+{
+	size_t pos = address.rfind(':');
+	if(string::npos == pos)
+	{
+		return address;
+	}
+	string host = address.substr(0, pos);
+	if(host.size() > 1 && '[' == host[0])
+	{
+		host = host.substr(1, host.size() - 2);
+	}
+	if(string::npos != host.find(':'))
+	{
+		host = "[" + host + "]";
+	}
+	return host + address.substr(pos);
+}
+
+static bool rttLess(const pair<int, size_t> &a, const pair<int, size_t> &b)
+{
+	// unreachable ones are the last
+	if((a.first < 0) != (b.first < 0))
+	{
+		return a.first >= 0;
+	}
+	return a < b;
+}
+
+ZkServerSelector::ZkServerSelector(const std::string &connectString, double skew/*=2.0*/, size_t minServers/*=2*/, int probeTimeout/*=500*/, 
+	size_t probesToMove/*=3*/, int minGap/*=1000*/)
+	: skew_ (skew)
+	, minServers_ (minServers)
+	, probeTimeout_ (probeTimeout)
+	, probesToMove_ (probesToMove)
+	, minGap_ (minGap)
+	, probed_ (false)
+	, skewedProbes_ (0)
+	, zk_ (NULL)
+	, interval_ (0)
+	, running_ (false)
+{
+	// "host:port,host:port/chroot"
+	string hosts = connectString;
+	size_t pos = hosts.find('/');
+	if(string::npos != pos)
+	{
+		chroot_ = hosts.substr(pos);
+		hosts = hosts.substr(0, pos);
+	}
+	istringstream is(hosts);
+	string hostPort;
+	while(getline(is, hostPort, ','))
+	{
+		if(!hostPort.empty())
+		{
+			Server server;
+			server.hostPort = hostPort;
+			server.rtt = -1;
+			servers_.push_back(server);
+		}
+	}
+}
+
+ZkServerSelector::~ZkServerSelector()
+{
+	stop();
+}
+
+size_t ZkServerSelector::probe()
+{
+	vector<Server> servers;
+	{
+		ZkMutex::Guard guard(mutex_);
+		servers = servers_;
+	}
+	// probe out of the lock, it takes at most probeTimeout_
+	probeServers(servers);
+	size_t reachable = 0;
+	ZkMutex::Guard guard(mutex_);
+	for(size_t i = 0; i < servers.size() && i < servers_.size(); ++i)
+	{
+		servers_[i].address = servers[i].address;
+		servers_[i].rtt = servers[i].rtt;
+		if(servers[i].rtt >= 0)
+		{
+			++reachable;
+		}
+	}
+	probed_ = true;
+	return reachable;
+}
+
+void ZkServerSelector::probeServers(std::vector<Server> &servers) const
+{
+	// connect to all servers at the same time, the time to get connected is the rtt
+	vector<SocketType> fds(servers.size(), INVALID_SOCKET);
+	vector<long long> starts(servers.size(), 0);
+	long long start = nowMicros();
+	for(size_t i = 0; i < servers.size(); ++i)
+	{
+		Server &server = servers[i];
+		server.rtt = -1;
+		size_t pos = server.hostPort.rfind(':');
+		string host = server.hostPort.substr(0, pos);
+		string port = (string::npos == pos) ? "2181" : server.hostPort.substr(pos + 1);
+		if(host.size() > 1 && '[' == host[0])
+		{
+			// ipv6, [ip]:port
+			host = host.substr(1, host.size() - 2);
+		}
+		struct addrinfo hints;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		struct addrinfo *res = NULL;
+		if(0 != getaddrinfo(host.c_str(), port.c_str(), &hints, &res) || NULL == res)
+		{
+			LOG_WARN(("resolve server failed, server=%s", server.hostPort.c_str()));
+			continue;
+		}
+		char ip[64] = {0};
+		char serv[16] = {0};
+		if(0 == getnameinfo(res->ai_addr, res->ai_addrlen, ip, sizeof(ip), serv, sizeof(serv), NI_NUMERICHOST|NI_NUMERICSERV))
+		{
+			server.address = normalizeAddress(string(ip) + ":" + serv);
+		}
+		SocketType fd = socket(res->ai_family, SOCK_STREAM, 0);
+		if(INVALID_SOCKET != fd && setNonBlocking(fd))
+		{
+			// resolving is not counted
+			starts[i] = nowMicros();
+			if(0 == connect(fd, res->ai_addr, res->ai_addrlen))
+			{
+				server.rtt = (int)(nowMicros() - starts[i]);
+				closeSocket(fd);
+			}
+			else if(connectPending())
+			{
+				fds[i] = fd;
+			}
+			else
+			{
+				closeSocket(fd);
+			}
+		}
+		else if(INVALID_SOCKET != fd)
+		{
+			closeSocket(fd);
+		}
+		freeaddrinfo(res);
+	}
+	long long deadline = start + probeTimeout_ * 1000LL;
+	// poll, not select, the fds may be beyond FD_SETSIZE in a process with many connections
+	vector<struct pollfd> pfds;
+	vector<size_t> index;
+	for(long long now = nowMicros(); now < deadline; now = nowMicros())
+	{
+		pfds.clear();
+		index.clear();
+		for(size_t i = 0; i < fds.size(); ++i)
+		{
+			if(INVALID_SOCKET != fds[i])
+			{
+				struct pollfd pfd;
+				pfd.fd = fds[i];
+				pfd.events = POLLOUT;
+				pfd.revents = 0;
+				pfds.push_back(pfd);
+				index.push_back(i);
+			}
+		}
+		if(pfds.empty())
+		{
+			break;
+		}
+		int timeout = (int)((deadline - now + 999) / 1000);
+		if(pollSockets(&pfds[0], pfds.size(), timeout) <= 0)
+		{
+			continue;
+		}
+		long long done = nowMicros();
+		for(size_t j = 0; j < pfds.size(); ++j)
+		{
+			if(0 == (pfds[j].revents & (POLLOUT|POLLERR|POLLHUP)))
+			{
+				continue;
+			}
+			size_t i = index[j];
+			int err = 0;
+			socklen_t len = sizeof(err);
+			getsockopt(fds[i], SOL_SOCKET, SO_ERROR, (char*)&err, &len);
+			if(0 == err)
+			{
+				servers[i].rtt = (int)(done - starts[i]);
+			}
+			closeSocket(fds[i]);
+			fds[i] = INVALID_SOCKET;
+		}
+	}
+	// timeout
+	for(size_t i = 0; i < fds.size(); ++i)
+	{
+		if(INVALID_SOCKET != fds[i])
+		{
+			closeSocket(fds[i]);
+		}
+	}
+}
+
+std::string ZkServerSelector::preferredConnectString()
+{
+	bool probed;
+	{
+		ZkMutex::Guard guard(mutex_);
+		probed = probed_;
+	}
+	if(!probed)
+	{
+		probe();
+	}
+	ZkMutex::Guard guard(mutex_);
+	return preferredLocked();
+}
+
+std::string ZkServerSelector::preferredLocked()
+{
+	vector<pair<int, size_t> > order;
+	for(size_t i = 0; i < servers_.size(); ++i)
+	{
+		order.push_back(make_pair(servers_[i].rtt, i));
+	}
+	sort(order.begin(), order.end(), rttLess);
+	string hosts;
+	bool reachable = !order.empty() && order[0].first >= 0;
+	for(size_t i = 0; i < order.size(); ++i)
+	{
+		// all of them if none is reachable
+		bool near = order[i].first >= 0 && order[i].first <= order[0].first * skew_;
+		if(reachable && i >= minServers_ && !near)
+		{
+			break;
+		}
+		if(!hosts.empty())
+		{
+			hosts += ",";
+		}
+		hosts += servers_[order[i].second].hostPort;
+	}
+	return hosts + chroot_;
+}
+
+int ZkServerSelector::serverIndex(const std::string &server)
+{
+	string address = normalizeAddress(server);
+	for(size_t i = 0; i < servers_.size(); ++i)
+	{
+		if(address == servers_[i].address || address == normalizeAddress(servers_[i].hostPort))
+		{
+			return (int)i;
+		}
+	}
+	return -1;
+}
+
+bool ZkServerSelector::isPreferred(const std::string &server)
+{
+	int i = serverIndex(server);
+	if(i < 0)
+	{
+		return false;
+	}
+	string hosts = preferredLocked();
+	string preferred = "," + hosts.substr(0, hosts.size() - chroot_.size()) + ",";
+	return string::npos != preferred.find("," + servers_[i].hostPort + ",");
+}
+
+// at least minGap_ farther than the nearest server, or unknown
+bool ZkServerSelector::isFarther(const std::string &server)
+{
+	int i = serverIndex(server);
+	if(i < 0 || servers_[i].rtt < 0)
+	{
+		return true;
+	}
+	int nearest = servers_[i].rtt;
+	for(size_t j = 0; j < servers_.size(); ++j)
+	{
+		if(servers_[j].rtt >= 0)
+		{
+			nearest = min(nearest, servers_[j].rtt);
+		}
+	}
+	return servers_[i].rtt - nearest >= minGap_;
+}
+
+ZkRet ZkServerSelector::rebalance(ZooKeeper &zk)
+{
+	probe();
+	string current = currentServer(zk);
+	string hosts;
+	{
+		ZkMutex::Guard guard(mutex_);
+		if(current.empty())
+		{
+			// disconnected, let the client try every server
+			skewedProbes_ = 0;
+			for(size_t i = 0; i < servers_.size(); ++i)
+			{
+				hosts += (i == 0 ? "" : ",") + servers_[i].hostPort;
+			}
+			hosts += chroot_;
+		}
+		else if(isPreferred(current) || !isFarther(current))
+		{
+			skewedProbes_ = 0;
+			return ZkRet(ZOK);
+		}
+		else if(++skewedProbes_ < probesToMove_)
+		{
+			// it may be a slow probe, confirmed by the next ones
+			LOG_DEBUG(("current server is not preferred, server=%s, probes=%lu", current.c_str(), (unsigned long)skewedProbes_));
+			return ZkRet(ZOK);
+		}
+		else
+		{
+			skewedProbes_ = 0;
+			hosts = preferredLocked();
+		}
+	}
+	LOG_INFO(("rebalance, current server=%s, servers=%s", current.c_str(), hosts.c_str()));
+	int ret = zk.setServers(hosts);
+	if(ZOK != ret)
+	{
+		LOG_ERROR(("set servers failed, servers=%s, ret=%s", hosts.c_str(), errorStr(ret)));
+	}
+	return ZkRet(ret);
+}
+
+std::string ZkServerSelector::currentServer(ZooKeeper &zk)
+{
+	return zk.currentServer();
+}
+
+std::map<std::string, int> ZkServerSelector::serverRtts()
+{
+	ZkMutex::Guard guard(mutex_);
+	map<string, int> rtts;
+	for(size_t i = 0; i < servers_.size(); ++i)
+	{
+		rtts[servers_[i].hostPort] = servers_[i].rtt;
+	}
+	return rtts;
+}
+
+void ZkServerSelector::start(ZooKeeper *zk, int intervalSec)
+{
+	ZkMutex::Guard guard(mutex_);
+	if(running_)
+	{
+		return;
+	}
+	zk_ = zk;
+	interval_ = intervalSec;
+	running_ = true;
+#ifdef WIN32
+	thread_ = CreateThread(NULL, 0, &ZkServerSelector::threadMain, this, 0, NULL);
+#else
+	pthread_create(&thread_, NULL, &ZkServerSelector::threadMain, this);
+#endif
+}
+
+void ZkServerSelector::stop()
+{
+	{
+		ZkMutex::Guard guard(mutex_);
+		if(!running_)
+		{
+			return;
+		}
+		running_ = false;
+		stopCond_.notifyAll();
+	}
+#ifdef WIN32
+	WaitForSingleObject(thread_, INFINITE);
+	CloseHandle(thread_);
+#else
+	pthread_join(thread_, NULL);
+#endif
+}
+
+void ZkServerSelector::run()
+{
+	mutex_.lock();
+	while(running_)
+	{
+		if(!stopCond_.wait(mutex_, interval_ * 1000) && running_)
+		{
+			mutex_.unlock();
+			rebalance(*zk_);
+			mutex_.lock();
+		}
+	}
+	mutex_.unlock();
+}
+
+#ifdef WIN32
+DWORD WINAPI ZkServerSelector::threadMain(LPVOID arg)
+{
+	static_cast<ZkServerSelector*>(arg)->run();
+	return 0;
+}
+#else
+void *ZkServerSelector::threadMain(void *arg)
+{
+	static_cast<ZkServerSelector*>(arg)->run();
+	return NULL;
+}
+#endif
@@ -0,0 +1,79 @@
+#ifndef _ZK_SERVER_SELECTOR_H_
+#define _ZK_SERVER_SELECTOR_H_
+
+#include "ZooKeeper.h"
+
+// class ZkServerSelector, latency-aware server selection, it needs zookeeper c client 3.5+ (zoo_set_servers).
+// the c client picks servers at random, so the selector probes the tcp connect time of every server,
+// and gives the client only the nearest ones: those within skew times of the nearest, at least minServers of them.
+// connect times of near servers vary from probe to probe, so the session is moved only when the current server
+// is not a preferred one in probesToMove probes in a row, and it's at least minGap microseconds farther than the nearest.
+// usage:
+//     ZkServerSelector selector("ip1:port1,ip2:port2,ip3:port3");
+//     zk.init(selector.preferredConnectString()); // probes all servers the first time
+//     selector.start(&zk, 60); // probe every 60s, move the session if the current server is not a preferred one
+// thread safety: all functions can be called from any thread.
+class ZkServerSelector : public boost::noncopyable
+{
+public:
+	// probeTimeout is in milisecond, minGap is in microsecond
+	explicit ZkServerSelector(const std::string &connectString, double skew = 2.0, size_t minServers = 2, int probeTimeout = 500, 
+		size_t probesToMove = 3, int minGap = 1000);
+	~ZkServerSelector();
+	// probe all servers, return the number of reachable ones
+	size_t probe();
+	// preferred servers, nearest first, the full list if none is reachable
+	std::string preferredConnectString();
+	// probe, then move the session to a preferred server if the current one has not been one for probesToMove probes, 
+	// or give the client back the full list if it's disconnected
+	ZkRet rebalance(ZooKeeper &zk);
+	// rebalance in a background thread every intervalSec seconds
+	void start(ZooKeeper *zk, int intervalSec);
+	void stop();
+	// the server the session is connected to, "ip:port", empty if not connected
+	std::string currentServer(ZooKeeper &zk);
+	// measured connect time of each server in microsecond, -1 if unreachable
+	std::map<std::string, int> serverRtts();
+private:
+	struct Server
+	{
+		std::string hostPort; // as in the connect string
+		std::string address;  // resolved "ip:port"
+		int rtt;
+	};
+	void probeServers(std::vector<Server> &servers) const;
+	std::string preferredLocked();
+	bool isPreferred(const std::string &server);
+	bool isFarther(const std::string &server);
+	int serverIndex(const std::string &server);
+	void run();
+#ifdef WIN32
+	static DWORD WINAPI threadMain(LPVOID arg);
+#else
+	static void *threadMain(void *arg);
+#endif
+	//
+	std::vector<Server> servers_;
+	std::string chroot_;
+	double skew_;
+	size_t minServers_;
+	int probeTimeout_;
+	size_t probesToMove_;
+	int minGap_;
+	bool probed_;
+	// consecutive probes with the session on a server to move from
+	size_t skewedProbes_;
+	ZkMutex mutex_;
+	// background thread
+	ZooKeeper *zk_;
+	int interval_;
+	bool running_;
+	ZkCondition stopCond_;
+#ifdef WIN32
+	HANDLE thread_;
+#else
+	pthread_t thread_;
+#endif
+};
+
+#endif
@@ -0,0 +1,454 @@
+#include <stdlib.h>
+#include <algorithm>
+#include <boost/bind.hpp>
+#include "ZkShardGroup.h"
+#include "ZkUtil.h"
+
+using namespace std;
+
+static string toDecimal(size_t n)
+{
+	char buf[24];
+	char *p = buf + sizeof(buf);
+	*--p = '\0';
+	do
+	{
+		*--p = (char)('0' + n % 10);
+		n /= 10;
+	}while(n);
+	return p;
+}
+
+ZkShardGroup::ZkShardGroup(ZooKeeper &zk, const std::string &groupPath, const std::string &memberId, size_t partitions,
+	int virtualNodes/*=100*/, int handoffTimeout/*=30000*/)
+	: core_ (new Core(zk, groupPath, memberId, partitions, virtualNodes, handoffTimeout))
+{
+
+}
+
+ZkShardGroup::Core::Core(ZooKeeper &zk, const std::string &groupPath, const std::string &memberId, size_t partitions,
+	int virtualNodes, int handoffTimeout)
+	: zk_ (zk)
+	, groupPath_ (groupPath)
+	, memberId_ (memberId)
+	, partitions_ (partitions)
+	, virtualNodes_ (virtualNodes)
+	, handoffTimeout_ (handoffTimeout)
+	, joined_ (false)
+	, states_ (partitions, NONE)
+	, deadlines_ (partitions, 0)
+	, holders_ (partitions)
+	, membersWatch_ (0)
+	, handoffWatch_ (0)
+	, running_ (false)
+{
+
+}
+
+ZkShardGroup::~ZkShardGroup()
+{
+	leave();
+}
+
+ZkRet ZkShardGroup::join(const AssignmentCallback &cb)
+{
+	{
+		ZkMutex::Guard guard(core_->mutex_);
+		if(core_->joined_)
+		{
+			return ZkRet(ZBADARGUMENTS);
+		}
+	}
+	string membersPath = core_->groupPath_ + "/members";
+	string handoffDir = core_->groupPath_ + "/handoff/" + core_->memberId_;
+	ZkRet zr = core_->zk_.createNode(membersPath, "", true);
+	if(!zr && !zr.nodeExist())
+	{
+		return zr;
+	}
+	zr = core_->zk_.createNode(handoffDir, "", true);
+	if(!zr && !zr.nodeExist())
+	{
+		return zr;
+	}
+	// markers are persistent, those left by an earlier member with the same id would let this one acquire
+	// partitions their live owners still hold. clear them before this member shows up in the view
+	vector<string> stale;
+	zr = core_->zk_.getChildren(handoffDir, stale);
+	if(!zr)
+	{
+		return zr;
+	}
+	for(size_t i = 0; i < stale.size(); ++i)
+	{
+		zr = core_->zk_.deleteNode(handoffDir + "/" + stale[i]);
+		if(!zr && !zr.nodeNotExist())
+		{
+			return zr;
+		}
+	}
+	// not a sequence node, it keeps its path when it's re-created after session expiry.
+	// ZNODEEXISTS if the id is taken, or the session of a crashed member with the same id is not expired yet
+	string memberPath = membersPath + "/" + core_->memberId_;
+	zr = core_->zk_.createEphemeralNode(memberPath, core_->memberId_, false);
+	if(!zr)
+	{
+		return zr;
+	}
+	{
+		ZkMutex::Guard guard(core_->mutex_);
+		core_->cb_ = cb;
+		core_->joined_ = true;
+		core_->memberPath_ = memberPath;
+		core_->running_ = true;
+#ifdef WIN32
+		core_->thread_ = CreateThread(NULL, 0, &ZkShardGroup::threadMain, core_.get(), 0, NULL);
+#else
+		pthread_create(&core_->thread_, NULL, &ZkShardGroup::threadMain, core_.get());
+#endif
+	}
+	core_->zk_.watchChildren(handoffDir, boost::bind(&Core::onHandoff, core_, _1, _2), &core_->handoffWatch_);
+	return core_->zk_.watchChildren(membersPath, boost::bind(&Core::onMembers, core_, _1, _2), &core_->membersWatch_);
+}
+
+ZkRet ZkShardGroup::leave()
+{
+	string memberPath;
+	{
+		ZkMutex::Guard guard(core_->mutex_);
+		if(!core_->joined_)
+		{
+			return ZkRet(ZOK);
+		}
+		core_->joined_ = false;
+		memberPath = core_->memberPath_;
+		// hand everything to the owners without this member
+		vector<string> members(core_->view_);
+		members.erase(std::remove(members.begin(), members.end(), core_->memberId_), members.end());
+		vector<int> owners;
+		computeOwners(members, core_->partitions_, core_->virtualNodes_, owners);
+		Delta delta;
+		for(size_t p = 0; p < core_->partitions_; ++p)
+		{
+			if(HELD == core_->states_[p] && owners[p] >= 0)
+			{
+				delta.released.push_back(p);
+				delta.newOwners.push_back(members[owners[p]]);
+			}
+			else if(HELD == core_->states_[p])
+			{
+				delta.released.push_back(p);
+				delta.newOwners.push_back("");
+			}
+			core_->states_[p] = NONE;
+		}
+		core_->view_.clear();
+		core_->owners_.clear();
+		core_->markers_.clear();
+		core_->deltas_.push_back(delta);
+		core_->running_ = false;
+		core_->cond_.notifyAll();
+	}
+#ifdef WIN32
+	WaitForSingleObject(core_->thread_, INFINITE);
+	CloseHandle(core_->thread_);
+#else
+	pthread_join(core_->thread_, NULL);
+#endif
+	core_->deliver();
+	{
+		// a watch callback still in flight finds nothing to deliver, and no callback to call
+		ZkMutex::Guard guard(core_->mutex_);
+		core_->cb_ = AssignmentCallback();
+	}
+	core_->zk_.unwatchChildren(core_->groupPath_ + "/members", core_->membersWatch_);
+	core_->zk_.unwatchChildren(core_->groupPath_ + "/handoff/" + core_->memberId_, core_->handoffWatch_);
+	// the handoff markers are queued before, and requests of a session are handled in order
+	return core_->zk_.deleteNode(memberPath);
+}
+
+std::vector<size_t> ZkShardGroup::ownedPartitions()
+{
+	vector<size_t> owned;
+	ZkMutex::Guard guard(core_->mutex_);
+	for(size_t p = 0; p < core_->partitions_; ++p)
+	{
+		if(HELD == core_->states_[p])
+		{
+			owned.push_back(p);
+		}
+	}
+	return owned;
+}
+
+std::vector<std::string> ZkShardGroup::members()
+{
+	ZkMutex::Guard guard(core_->mutex_);
+	return core_->view_;
+}
+
+// fnv-1a, then the murmur3 finalizer to spread similar keys over the ring
+unsigned int ZkShardGroup::hash(const std::string &key)
+{
+	unsigned int h = 2166136261u;
+	for(size_t i = 0; i < key.size(); ++i)
+	{
+		h ^= (unsigned char)key[i];
+		h *= 16777619u;
+	}
+	h ^= h >> 16;
+	h *= 0x85ebca6bu;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35u;
+	h ^= h >> 16;
+	return h;
+}
+
+void ZkShardGroup::computeOwners(const std::vector<std::string> &members, size_t partitions, int virtualNodes, std::vector<int> &owners)
+{
+	owners.assign(partitions, -1);
+	if(members.empty())
+	{
+		return;
+	}
+	vector<pair<unsigned int, int> > ring;
+	ring.reserve(members.size() * virtualNodes);
+	for(size_t i = 0; i < members.size(); ++i)
+	{
+		for(int v = 0; v < virtualNodes; ++v)
+		{
+			ring.push_back(make_pair(hash(members[i] + "#" + toDecimal(v)), (int)i));
+		}
+	}
+	std::sort(ring.begin(), ring.end());
+	for(size_t p = 0; p < partitions; ++p)
+	{
+		vector<pair<unsigned int, int> >::const_iterator it = std::lower_bound(ring.begin(), ring.end(), make_pair(hash("partition#" + toDecimal(p)), -1));
+		if(ring.end() == it)
+		{
+			it = ring.begin();
+		}
+		owners[p] = it->second;
+	}
+}
+
+void ZkShardGroup::Core::onMembers(const std::string &path, const std::vector<std::string> &children)
+{
+	set<string> alive(children.begin(), children.end());
+	vector<string> members(alive.begin(), alive.end());
+	vector<int> owners;
+	computeOwners(members, partitions_, virtualNodes_, owners);
+	{
+		ZkMutex::Guard guard(mutex_);
+		// not registered yet, or re-registering after session expiry, keep what it holds
+		if(!joined_ || !alive.count(memberId_))
+		{
+			LOG_DEBUG(("member %s is not in the view of %s", memberId_.c_str(), groupPath_.c_str()));
+			return;
+		}
+		vector<string> prevMembers(view_);
+		vector<int> prevOwners(owners_);
+		if(prevMembers.empty())
+		{
+			// the first view, partitions come from the others
+			prevMembers = members;
+			prevMembers.erase(std::remove(prevMembers.begin(), prevMembers.end(), memberId_), prevMembers.end());
+			computeOwners(prevMembers, partitions_, virtualNodes_, prevOwners);
+		}
+		long long deadline = nowMicros() + handoffTimeout_ * 1000LL;
+		Delta delta;
+		for(size_t p = 0; p < partitions_; ++p)
+		{
+			const string &owner = members[owners[p]];
+			bool mine = (owner == memberId_);
+			if(HELD == states_[p] && !mine)
+			{
+				delta.released.push_back(p);
+				delta.newOwners.push_back(owner);
+				states_[p] = NONE;
+			}
+			else if(WAITING == states_[p] && !mine)
+			{
+				states_[p] = NONE;
+			}
+			else if(WAITING == states_[p] && !alive.count(holders_[p]))
+			{
+				acquireLocked(p, delta);
+			}
+			else if(NONE == states_[p] && mine)
+			{
+				const string prevOwner = prevOwners[p] >= 0 ? prevMembers[prevOwners[p]] : string();
+				if(handoffTimeout_ > 0 && !prevOwner.empty() && alive.count(prevOwner))
+				{
+					// wait for the old owner to hand it over
+					states_[p] = WAITING;
+					holders_[p] = prevOwner;
+					deadlines_[p] = deadline;
+				}
+				else
+				{
+					acquireLocked(p, delta);
+				}
+			}
+		}
+		view_ = members;
+		owners_ = owners;
+		// the view is fresh now, markers of partitions owned by others are passed on
+		for(set<size_t>::iterator it = markers_.begin(); it != markers_.end(); )
+		{
+			size_t p = *it;
+			if(WAITING == states_[p])
+			{
+				acquireLocked(p, delta);
+			}
+			else if(NONE == states_[p])
+			{
+				zk_.createNodeQueued(handoffPath(members[owners[p]], p), memberId_);
+			}
+			zk_.deleteNodeQueued(handoffPath(memberId_, p));
+			markers_.erase(it++);
+		}
+		if(!delta.acquired.empty() || !delta.released.empty())
+		{
+			LOG_DEBUG(("group %s changed, members=%lu, acquired=%lu, released=%lu", groupPath_.c_str(), (unsigned long)members.size(),
+				(unsigned long)delta.acquired.size(), (unsigned long)delta.released.size()));
+			deltas_.push_back(delta);
+		}
+		cond_.notifyAll();
+	}
+	deliver();
+}
+
+void ZkShardGroup::Core::onHandoff(const std::string &path, const std::vector<std::string> &children)
+{
+	{
+		ZkMutex::Guard guard(mutex_);
+		if(!joined_)
+		{
+			return;
+		}
+		Delta delta;
+		for(size_t i = 0; i < children.size(); ++i)
+		{
+			size_t p = (size_t)strtoul(children[i].c_str(), NULL, 10);
+			if(p >= partitions_)
+			{
+				continue;
+			}
+			if(WAITING == states_[p] || HELD == states_[p])
+			{
+				if(WAITING == states_[p])
+				{
+					acquireLocked(p, delta);
+				}
+				zk_.deleteNodeQueued(handoffPath(memberId_, p));
+			}
+			else
+			{
+				// ahead of this member's view, settled when the view changes
+				markers_.insert(p);
+			}
+		}
+		if(!delta.acquired.empty())
+		{
+			deltas_.push_back(delta);
+		}
+	}
+	deliver();
+}
+
+// mutex_ must be held by the caller
+void ZkShardGroup::Core::acquireLocked(size_t p, Delta &delta)
+{
+	states_[p] = HELD;
+	delta.acquired.push_back(p);
+}
+
+void ZkShardGroup::Core::deliver()
+{
+	ZkMutex::Guard deliverGuard(deliverMutex_);
+	while(true)
+	{
+		Delta delta;
+		AssignmentCallback cb;
+		{
+			ZkMutex::Guard guard(mutex_);
+			if(deltas_.empty())
+			{
+				break;
+			}
+			delta = deltas_.front();
+			deltas_.pop_front();
+			cb = cb_;
+		}
+		if(cb)
+		{
+			cb(delta.acquired, delta.released);
+		}
+		// released by the callback, hand them over
+		for(size_t i = 0; i < delta.released.size(); ++i)
+		{
+			if(!delta.newOwners[i].empty())
+			{
+				zk_.createNodeQueued(handoffPath(delta.newOwners[i], delta.released[i]), memberId_);
+			}
+		}
+	}
+}
+
+std::string ZkShardGroup::Core::handoffPath(const std::string &memberId, size_t p) const
+{
+	return groupPath_ + "/handoff/" + memberId + "/" + toDecimal(p);
+}
+
+// acquire the partitions whose old owners do not hand them over in time
+void ZkShardGroup::Core::run()
+{
+	mutex_.lock();
+	while(running_)
+	{
+		long long now = nowMicros();
+		long long next = now + 1000000;
+		Delta delta;
+		for(size_t p = 0; p < partitions_; ++p)
+		{
+			if(WAITING != states_[p])
+			{
+				continue;
+			}
+			if(deadlines_[p] <= now)
+			{
+				LOG_WARN(("partition %lu is not handed over by %s in time", (unsigned long)p, holders_[p].c_str()));
+				acquireLocked(p, delta);
+			}
+			else if(deadlines_[p] < next)
+			{
+				next = deadlines_[p];
+			}
+		}
+		if(!delta.acquired.empty())
+		{
+			deltas_.push_back(delta);
+			mutex_.unlock();
+			deliver();
+			mutex_.lock();
+			continue;
+		}
+		cond_.wait(mutex_, static_cast<int>((next - now + 999) / 1000));
+	}
+	mutex_.unlock();
+}
+
+#ifdef WIN32
+DWORD WINAPI ZkShardGroup::threadMain(LPVOID arg)
+{
+	static_cast<Core*>(arg)->run();
+	return 0;
+}
+#else
+void *ZkShardGroup::threadMain(void *arg)
+{
+	static_cast<Core*>(arg)->run();
+	return NULL;
+}
+#endif
@@ -0,0 +1,97 @@
+#ifndef _ZK_SHARD_GROUP_H_
+#define _ZK_SHARD_GROUP_H_
+
+#include <set>
+#include "ZooKeeper.h"
+
+// class ZkShardGroup, partitions [0, partitions) split among the members of a group by consistent hashing.
+// every member is placed on a hash ring at virtualNodes points, a partition belongs to the next point on the ring,
+// so a member joining or leaving moves only about 1/members of the partitions, and each member gets just its own deltas.
+// znodes under groupPath:
+//     members/<memberId>             ephemeral node of each member
+//     handoff/<memberId>/<partition> a released partition handed to its new owner, cleared when the member joins
+// handoff barrier: a partition moving from a live member is acquired only after the old owner's callback
+// has released it, or handoffTimeout miliseconds later. a partition of a member that is gone is acquired at once.
+// usage:
+//     ZkShardGroup group(zk, "/jobs/group", "worker7", 10000);
+//     group.join(assignmentCallback); // assignmentCallback(acquired, released)
+//     group.leave();                  // hands all partitions over, then leaves
+// the callback is called in order, in the zookeeper thread or the handoff timer thread,
+// it must not call join or leave.
+class ZkShardGroup : public boost::noncopyable
+{
+public:
+	typedef boost::function<void (const std::vector<size_t> &acquired, const std::vector<size_t> &released)> AssignmentCallback;
+	// memberId must be unique in the group and not contain '/'
+	ZkShardGroup(ZooKeeper &zk, const std::string &groupPath, const std::string &memberId, size_t partitions,
+		int virtualNodes = 100, int handoffTimeout = 30000);
+	~ZkShardGroup();
+	ZkRet join(const AssignmentCallback &cb);
+	ZkRet leave();
+	// partitions held now, sorted
+	std::vector<size_t> ownedPartitions();
+	// member ids of the current view, sorted
+	std::vector<std::string> members();
+	//
+	static unsigned int hash(const std::string &key);
+	// owners[p] is the index in members of the owner of partition p, -1 if members is empty
+	static void computeOwners(const std::vector<std::string> &members, size_t partitions, int virtualNodes, std::vector<int> &owners);
+private:
+	enum State {NONE, HELD, WAITING};
+	struct Delta
+	{
+		std::vector<size_t> acquired;
+		std::vector<size_t> released;
+		std::vector<std::string> newOwners; // of the released ones
+	};
+	// shared with the watch callbacks, which may still run after the group is destroyed
+	struct Core
+	{
+		Core(ZooKeeper &zk, const std::string &groupPath, const std::string &memberId, size_t partitions, int virtualNodes, int handoffTimeout);
+		void onMembers(const std::string &path, const std::vector<std::string> &children);
+		void onHandoff(const std::string &path, const std::vector<std::string> &children);
+		void acquireLocked(size_t p, Delta &delta);
+		void deliver();
+		std::string handoffPath(const std::string &memberId, size_t p) const;
+		void run();
+		//
+		ZooKeeper &zk_;
+		std::string groupPath_;
+		std::string memberId_;
+		size_t partitions_;
+		int virtualNodes_;
+		int handoffTimeout_;
+		AssignmentCallback cb_;
+		// guarded by mutex_
+		ZkMutex mutex_;
+		bool joined_;
+		std::string memberPath_;
+		std::vector<std::string> view_;
+		std::vector<int> owners_;
+		std::vector<char> states_;
+		std::vector<long long> deadlines_;  // of waiting partitions
+		std::vector<std::string> holders_;  // expected old owners of waiting partitions
+		std::set<size_t> markers_;          // handed over ahead of the view of this member
+		std::list<Delta> deltas_;
+		ZooKeeper::WatchId membersWatch_;
+		ZooKeeper::WatchId handoffWatch_;
+		// callbacks run one at a time, in order
+		ZkMutex deliverMutex_;
+		// handoff timer
+		ZkCondition cond_;
+		bool running_;
+#ifdef WIN32
+		HANDLE thread_;
+#else
+		pthread_t thread_;
+#endif
+	};
+#ifdef WIN32
+	static DWORD WINAPI threadMain(LPVOID arg);
+#else
+	static void *threadMain(void *arg);
+#endif
+	boost::shared_ptr<Core> core_;
+};
+
+#endif
@@ -0,0 +1,599 @@
+// exportTree and importTree of class ZooKeeper
+//
+// file format, integers are little-endian:
+//     "CPPZKT01"
+//     records, parents before children: u32 path length, path relative to root ("" for root), u32 data length, data
+//     trailer: u32 0xffffffff, u64 record count
+#include <stdio.h>
+#include <string.h>
+#include <deque>
+#include <boost/scoped_array.hpp>
+#include "ZooKeeper.h"
+#include "ZkUtil.h"
+
+using namespace std;
+
+#define ZK_TREE_MAGIC "CPPZKT01"
+#define ZK_TREE_END 0xffffffffu
+// keep a multi request far below jute.maxbuffer(1M)
+#define ZK_TREE_BATCH_BYTES (512 * 1024)
+// at most such many multi requests in flight
+#define ZK_TREE_BATCH_WINDOW 8
+
+static void writeUint32(FILE *fp, unsigned int v)
+{
+	unsigned char buf[4] = {(unsigned char)v, (unsigned char)(v >> 8), (unsigned char)(v >> 16), (unsigned char)(v >> 24)};
+	fwrite(buf, 1, sizeof(buf), fp);
+}
+
+static bool readUint32(FILE *fp, unsigned int &v)
+{
+	unsigned char buf[4];
+	if(fread(buf, 1, sizeof(buf), fp) != sizeof(buf))
+	{
+		return false;
+	}
+	v = buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((unsigned int)buf[3] << 24);
+	return true;
+}
+
+static void writeString(FILE *fp, const std::string &s)
+{
+	writeUint32(fp, s.size());
+	fwrite(s.data(), 1, s.size(), fp);
+}
+
+static bool readString(FILE *fp, unsigned int len, std::string &s)
+{
+	s.resize(len);
+	return 0 == len || fread(&s[0], 1, len, fp) == len;
+}
+
+static std::string relativePath(const std::string &root, const std::string &path)
+{
+	if(path == root)
+	{
+		return "";
+	}
+	return ("/" == root) ? path : path.substr(root.size());
+}
+
+static std::string absolutePath(const std::string &root, const std::string &rpath)
+{
+	if(rpath.empty())
+	{
+		return root;
+	}
+	return ("/" == root) ? rpath : root + rpath;
+}
+
+// export
+
+namespace
+{
+	struct ExportNode;
+	// shared by the exporting thread and the completion thread
+	struct ExportState
+	{
+		ExportState() : inflight (0), error (ZOK) {}
+		ZkMutex mutex;
+		ZkCondition cond;
+		deque<string> pending; // paths to read
+		int inflight;
+		deque<ExportNode*> listing; // data read, children to be listed by the exporting thread
+		deque<ExportNode*> done; // to be written, parents before children
+		int error;
+	};
+	struct ExportNode
+	{
+		ExportState *state;
+		string path;
+		string data;
+		vector<string> children;
+	};
+}
+
+static void exportChildrenCompletion(int rc, const struct String_vector *strings, const void *data)
+{
+	ExportNode *node = static_cast<ExportNode*>(const_cast<void*>(data));
+	ExportState *state = node->state;
+	ZkMutex::Guard guard(state->mutex);
+	--state->inflight;
+	if(ZOK == rc)
+	{
+		for(int i = 0; i < strings->count; ++i)
+		{
+			node->children.push_back(strings->data[i]);
+		}
+		state->done.push_back(node);
+	}
+	else if(ZNONODE == rc)
+	{
+		// deleted while exporting
+		delete node;
+	}
+	else
+	{
+		LOG_ERROR(("export get children failed, path=%s, ret=%s", node->path.c_str(), errorStr(rc)));
+		state->error = rc;
+		delete node;
+	}
+	state->cond.notifyAll();
+}
+
+static void exportDataCompletion(int rc, const char *value, int valueLen, const struct Stat *stat, const void *data)
+{
+	ExportNode *node = static_cast<ExportNode*>(const_cast<void*>(data));
+	ExportState *state = node->state;
+	ZkMutex::Guard guard(state->mutex);
+	if(ZOK == rc && 0 == stat->ephemeralOwner)
+	{
+		node->data.assign(value ? value : "", value ? valueLen : 0);
+		if(stat->numChildren > 0)
+		{
+			// still in flight, the exporting thread lists the children
+			state->listing.push_back(node);
+			state->cond.notifyAll();
+			return;
+		}
+		else
+		{
+			state->done.push_back(node);
+			node = NULL;
+		}
+	}
+	else if(ZOK == rc || ZNONODE == rc)
+	{
+		// ephemeral nodes are skipped, so are nodes deleted while exporting
+		rc = ZOK;
+	}
+	if(ZOK != rc)
+	{
+		LOG_ERROR(("export get failed, path=%s, ret=%s", node->path.c_str(), errorStr(rc)));
+		state->error = rc;
+	}
+	delete node;
+	--state->inflight;
+	state->cond.notifyAll();
+}
+
+ZkRet ZooKeeper::exportTree(const std::string &root, const std::string &file, const ProgressCallback &progress/*=ProgressCallback()*/, int window/*=256*/)
+{
+	FILE *fp = fopen(file.c_str(), "wb");
+	if(NULL == fp)
+	{
+		LOG_ERROR(("open %s failed", file.c_str()));
+		return ZkRet(ZSYSTEMERROR);
+	}
+	fwrite(ZK_TREE_MAGIC, 1, strlen(ZK_TREE_MAGIC), fp);
+	long long start = nowMicros();
+	long long lastReport = start;
+	size_t nodes = 0;
+	size_t bytes = 0;
+	ExportState state;
+	state.pending.push_back(root);
+	state.mutex.lock();
+	while(ZOK == state.error)
+	{
+		// the handle is pinned only while sending, never while waiting for the completions
+		{
+			HandleRef zh(this);
+			while(!state.listing.empty())
+			{
+				ExportNode *node = state.listing.front();
+				state.listing.pop_front();
+				int ret = zoo_aget_children(zh.get(), node->path.c_str(), 0, &exportChildrenCompletion, node);
+				if(ZOK != ret)
+				{
+					LOG_ERROR(("export aget children failed, path=%s, ret=%s", node->path.c_str(), errorStr(ret)));
+					delete node;
+					--state.inflight;
+					state.error = ret;
+					break;
+				}
+			}
+			// keep the window full
+			while(ZOK == state.error && state.inflight < window && !state.pending.empty())
+			{
+				ExportNode *node = new ExportNode;
+				node->state = &state;
+				node->path = state.pending.front();
+				state.pending.pop_front();
+				int ret = zoo_aget(zh.get(), node->path.c_str(), 0, &exportDataCompletion, node);
+				if(ZOK != ret)
+				{
+					LOG_ERROR(("export aget failed, path=%s, ret=%s", node->path.c_str(), errorStr(ret)));
+					delete node;
+					state.error = ret;
+					break;
+				}
+				++state.inflight;
+			}
+		}
+		if(ZOK != state.error || (0 == state.inflight && state.pending.empty() && state.done.empty()))
+		{
+			break;
+		}
+		if(state.done.empty())
+		{
+			if(state.listing.empty())
+			{
+				state.cond.wait(state.mutex);
+			}
+			continue;
+		}
+		deque<ExportNode*> done;
+		done.swap(state.done);
+		for(size_t i = 0; i < done.size(); ++i)
+		{
+			ExportNode *node = done[i];
+			for(size_t j = 0; j < node->children.size(); ++j)
+			{
+				if("/" == node->path && "zookeeper" == node->children[j])
+				{
+					continue;
+				}
+				state.pending.push_back(("/" == node->path ? "" : node->path) + "/" + node->children[j]);
+			}
+		}
+		// write it out of the lock
+		state.mutex.unlock();
+		for(size_t i = 0; i < done.size(); ++i)
+		{
+			ExportNode *node = done[i];
+			writeString(fp, relativePath(root, node->path));
+			writeString(fp, node->data);
+			++nodes;
+			bytes += node->path.size() + node->data.size() + 8;
+			delete node;
+		}
+		long long now = nowMicros();
+		if(progress && now - lastReport >= 1000000)
+		{
+			lastReport = now;
+			progress(nodes, bytes, (now - start) / 1000000.0);
+		}
+		state.mutex.lock();
+	}
+	// wait for the requests in flight, they refer to state
+	while(state.inflight > 0)
+	{
+		if(state.listing.empty())
+		{
+			state.cond.wait(state.mutex);
+			continue;
+		}
+		// not sent anymore
+		delete state.listing.front();
+		state.listing.pop_front();
+		--state.inflight;
+	}
+	for(size_t i = 0; i < state.done.size(); ++i)
+	{
+		delete state.done[i];
+	}
+	int error = state.error;
+	state.mutex.unlock();
+	// a file without the trailer is never imported
+	if(ZOK == error)
+	{
+		writeUint32(fp, ZK_TREE_END);
+		writeUint32(fp, (unsigned int)nodes);
+		writeUint32(fp, (unsigned int)((unsigned long long)nodes >> 32));
+	}
+	if(0 != fclose(fp) && ZOK == error)
+	{
+		LOG_ERROR(("write %s failed", file.c_str()));
+		error = ZSYSTEMERROR;
+	}
+	if(ZOK == error && 0 == nodes)
+	{
+		error = ZNONODE;
+	}
+	double seconds = (nowMicros() - start) / 1000000.0;
+	if(progress)
+	{
+		progress(nodes, bytes, seconds);
+	}
+	LOG_INFO(("export %s to %s, nodes=%lu, bytes=%lu, seconds=%.3f, ret=%s", root.c_str(), file.c_str(), 
+		(unsigned long)nodes, (unsigned long)bytes, seconds, errorStr(error)));
+	return ZkRet(error);
+}
+
+// import
+
+namespace
+{
+	// a zoo_multi request of import
+	struct ImportBatch
+	{
+		ImportBatch() : ready (false), rc (ZOK) {}
+		vector<string> paths;
+		vector<string> values;
+		boost::scoped_array<zoo_op_t> ops;
+		boost::scoped_array<zoo_op_result_t> results;
+		bool ready;
+		int rc;
+		ZkMutex *mutex;
+		ZkCondition *cond;
+	};
+}
+
+static void importMultiCompletion(int rc, const void *data)
+{
+	ImportBatch *batch = static_cast<ImportBatch*>(const_cast<void*>(data));
+	ZkMutex::Guard guard(*batch->mutex);
+	batch->rc = rc;
+	batch->ready = true;
+	batch->cond->notifyAll();
+}
+
+// fnv-1a of the whole file
+static unsigned int fileChecksum(const std::string &file)
+{
+	unsigned int h = 2166136261u;
+	FILE *fp = fopen(file.c_str(), "rb");
+	if(NULL == fp)
+	{
+		return h;
+	}
+	unsigned char buf[64 * 1024];
+	size_t n;
+	while((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+	{
+		for(size_t i = 0; i < n; ++i)
+		{
+			h = (h ^ buf[i]) * 16777619u;
+		}
+	}
+	fclose(fp);
+	return h;
+}
+
+// checkpoint file: "fileSize checksum count", then the root in the second line
+static bool readCheckpoint(const std::string &file, long fileSize, const std::string &root, unsigned int &checksum, size_t &count)
+{
+	FILE *fp = fopen(file.c_str(), "r");
+	if(NULL == fp)
+	{
+		return false;
+	}
+	long size = 0;
+	unsigned long n = 0;
+	char line[4096] = {0};
+	bool ok = (3 == fscanf(fp, "%ld %x %lu\n", &size, &checksum, &n)) && NULL != fgets(line, sizeof(line), fp);
+	fclose(fp);
+	string path(line);
+	if(!path.empty() && '\n' == path[path.size() - 1])
+	{
+		path.erase(path.size() - 1);
+	}
+	count = n;
+	return ok && size == fileSize && path == root;
+}
+
+static void writeCheckpoint(const std::string &file, long fileSize, const std::string &root, unsigned int checksum, size_t count)
+{
+	FILE *fp = fopen(file.c_str(), "w");
+	if(fp)
+	{
+		fprintf(fp, "%ld %08x %lu\n%s\n", fileSize, checksum, (unsigned long)count, root.c_str());
+		fclose(fp);
+	}
+}
+
+ZkRet ZooKeeper::importTree(const std::string &file, const std::string &root, bool resume/*=true*/, const ProgressCallback &progress/*=ProgressCallback()*/, int batchSize/*=200*/)
+{
+	FILE *fp = fopen(file.c_str(), "rb");
+	if(NULL == fp)
+	{
+		LOG_ERROR(("open %s failed", file.c_str()));
+		return ZkRet(ZSYSTEMERROR);
+	}
+	fseek(fp, 0, SEEK_END);
+	long fileSize = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	char magic[8] = {0};
+	if(fread(magic, 1, sizeof(magic), fp) != sizeof(magic) || 0 != memcmp(magic, ZK_TREE_MAGIC, sizeof(magic)))
+	{
+		LOG_ERROR(("%s is not exported by exportTree", file.c_str()));
+		fclose(fp);
+		return ZkRet(ZBADARGUMENTS);
+	}
+	// the trailer is written only by a successful export
+	unsigned int end = 0;
+	unsigned int low = 0;
+	unsigned int high = 0;
+	if(0 != fseek(fp, -12, SEEK_END) || !readUint32(fp, end) || !readUint32(fp, low) || !readUint32(fp, high) || ZK_TREE_END != end)
+	{
+		LOG_ERROR(("%s is truncated or of a failed export", file.c_str()));
+		fclose(fp);
+		return ZkRet(ZMARSHALLINGERROR);
+	}
+	unsigned long long total = ((unsigned long long)high << 32) | low;
+	fseek(fp, sizeof(magic), SEEK_SET);
+	// nodes imported by the last failed import of the same file to the same root
+	string checkpoint = file + ".progress";
+	size_t skip = 0;
+	// read the whole file once here, not while batches are in flight
+	unsigned int checksum = fileChecksum(file);
+	unsigned int lastChecksum = 0;
+	if(!resume || !readCheckpoint(checkpoint, fileSize, root, lastChecksum, skip) || checksum != lastChecksum)
+	{
+		skip = 0;
+	}
+	if(skip > 0)
+	{
+		LOG_INFO(("resume import of %s, skip %lu nodes", file.c_str(), (unsigned long)skip));
+	}
+	long long start = nowMicros();
+	long long lastReport = start;
+	size_t records = 0;
+	size_t imported = skip;
+	size_t bytes = 0;
+	int error = ZOK;
+	bool ended = false;
+	ZkMutex mutex;
+	ZkCondition cond;
+	deque<ImportBatch*> inflight;
+	while(ZOK == error && (!ended || !inflight.empty()))
+	{
+		// read a batch and send it
+		if(!ended && (int)inflight.size() < ZK_TREE_BATCH_WINDOW)
+		{
+			ImportBatch *batch = new ImportBatch;
+			batch->mutex = &mutex;
+			batch->cond = &cond;
+			size_t batchBytes = 0;
+			while((int)batch->paths.size() < batchSize && batchBytes < ZK_TREE_BATCH_BYTES)
+			{
+				unsigned int len = 0;
+				string rpath, value;
+				if(!readUint32(fp, len))
+				{
+					LOG_ERROR(("%s is truncated", file.c_str()));
+					error = ZMARSHALLINGERROR;
+					break;
+				}
+				if(ZK_TREE_END == len)
+				{
+					ended = true;
+					if(records != total)
+					{
+						LOG_ERROR(("%s has %lu nodes, but %llu in the trailer", file.c_str(), (unsigned long)records, total));
+						error = ZMARSHALLINGERROR;
+					}
+					break;
+				}
+				if(!readString(fp, len, rpath) || !readUint32(fp, len) || !readString(fp, len, value))
+				{
+					LOG_ERROR(("%s is truncated", file.c_str()));
+					error = ZMARSHALLINGERROR;
+					break;
+				}
+				if(records++ < skip)
+				{
+					continue;
+				}
+				bytes += rpath.size() + value.size() + 8;
+				if(rpath.empty())
+				{
+					// the root, its parents may not exist
+					ZkRet zr = setData(root, value);
+					if(!zr)
+					{
+						error = zr.code();
+						break;
+					}
+					++imported;
+					continue;
+				}
+				batch->paths.push_back(absolutePath(root, rpath));
+				batch->values.push_back(value);
+				batchBytes += rpath.size() + value.size();
+			}
+			if(ZOK != error || batch->paths.empty())
+			{
+				delete batch;
+				continue;
+			}
+			int count = batch->paths.size();
+			batch->ops.reset(new zoo_op_t[count]);
+			batch->results.reset(new zoo_op_result_t[count]);
+			for(int i = 0; i < count; ++i)
+			{
+				zoo_create_op_init(&batch->ops[i], batch->paths[i].c_str(), batch->values[i].c_str(), batch->values[i].length(), 
+					&ZOO_OPEN_ACL_UNSAFE, 0, NULL, 0);
+			}
+			int ret;
+			{
+				HandleRef zh(this);
+				ret = zoo_amulti(zh.get(), count, batch->ops.get(), batch->results.get(), &importMultiCompletion, batch);
+			}
+			if(ZOK != ret)
+			{
+				LOG_ERROR(("import amulti failed, ret=%s", errorStr(ret)));
+				delete batch;
+				error = ret;
+				continue;
+			}
+			inflight.push_back(batch);
+			continue;
+		}
+		// the oldest batch is done, batches are done in order
+		ImportBatch *batch = inflight.front();
+		{
+			ZkMutex::Guard guard(mutex);
+			while(!batch->ready)
+			{
+				cond.wait(mutex);
+			}
+		}
+		inflight.pop_front();
+		if(ZOK != batch->rc)
+		{
+			// some nodes exist, or the parents of a failed batch do not, create them one by one
+			for(size_t i = 0; i < batch->paths.size() && ZOK == error; ++i)
+			{
+				const string &path = batch->paths[i];
+				const string &value = batch->values[i];
+				int ret = createNode(path, value, true).code();
+				if(ZNODEEXISTS == ret)
+				{
+					ret = setData(path, value).code();
+				}
+				if(ZOK != ret)
+				{
+					LOG_ERROR(("import node failed, path=%s, ret=%s", path.c_str(), errorStr(ret)));
+					error = ret;
+				}
+			}
+		}
+		if(ZOK == error)
+		{
+			imported += batch->paths.size();
+		}
+		delete batch;
+		long long now = nowMicros();
+		if(now - lastReport >= 1000000)
+		{
+			lastReport = now;
+			writeCheckpoint(checkpoint, fileSize, root, checksum, imported);
+			if(progress)
+			{
+				progress(imported, bytes, (now - start) / 1000000.0);
+			}
+		}
+	}
+	// wait for the requests in flight, they refer to batches
+	while(!inflight.empty())
+	{
+		ImportBatch *batch = inflight.front();
+		{
+			ZkMutex::Guard guard(mutex);
+			while(!batch->ready)
+			{
+				cond.wait(mutex);
+			}
+		}
+		inflight.pop_front();
+		delete batch;
+	}
+	fclose(fp);
+	if(ZOK == error)
+	{
+		remove(checkpoint.c_str());
+	}
+	else
+	{
+		writeCheckpoint(checkpoint, fileSize, root, checksum, imported);
+	}
+	double seconds = (nowMicros() - start) / 1000000.0;
+	if(progress)
+	{
+		progress(imported, bytes, seconds);
+	}
+	LOG_INFO(("import %s to %s, nodes=%lu, bytes=%lu, seconds=%.3f, ret=%s", file.c_str(), root.c_str(), 
+		(unsigned long)imported, (unsigned long)bytes, seconds, errorStr(error)));
+	return ZkRet(error);
+}
@@ -0,0 +1,132 @@
+#include "ZkUtil.h"
+#ifdef WIN32
+#include <Windows.h>
+#else
+#include <sys/time.h>
+#endif
+
+using namespace std;
+
+const char*  errorStr(int code)
+{
+	switch(code)
+	{
+	case ZOK:
+		return "Everything is OK";
+	case ZSYSTEMERROR:
+		return "System error";
+	case ZRUNTIMEINCONSISTENCY:
+		return "A runtime inconsistency was found";
+	case ZDATAINCONSISTENCY:
+		return "A data inconsistency was found";
+	case ZCONNECTIONLOSS:
+		return "Connection to the server has been lost";
+	case ZMARSHALLINGERROR:
+		return "Error while marshalling or unmarshalling data";
+	case ZUNIMPLEMENTED:
+		return "Operation is unimplemented";
+	case ZOPERATIONTIMEOUT:
+		return "Operation timeout";
+	case ZBADARGUMENTS:
+		return "Invalid arguments";
+	case ZINVALIDSTATE:
+		return "Invalid zhandle state";
+	case ZAPIERROR:
+		return "Api error";
+	case ZNONODE:
+		return "Node does not exist";
+	case ZNOAUTH:
+		return "Not authenticated";
+	case ZBADVERSION:
+		return "Version conflict";
+	case ZNOCHILDRENFOREPHEMERALS:
+		return "Ephemeral nodes may not have children";
+	case ZNODEEXISTS:
+		return "The node already exists";
+	case ZNOTEMPTY:
+		return "The node has children";
+	case ZSESSIONEXPIRED:
+		return "The session has been expired by the server";
+	case ZINVALIDCALLBACK:
+		return "Invalid callback specified";
+	case ZINVALIDACL:
+		return "Invalid ACL specified";
+	case ZAUTHFAILED:
+		return "Client authentication failed";
+	case ZCLOSING:
+		return "ZooKeeper is closing";
+	case ZNOTHING:
+		return "(not error) no server responses to process";
+	case ZSESSIONMOVED:
+		return "Session moved to another server, so operation is ignored";
+	default:
+		return "unknown error";
+	}
+}
+
+const char* eventStr(int event)
+{
+	if(ZOO_CREATED_EVENT == event)
+		return "ZOO_CREATED_EVENT";
+	else if(ZOO_DELETED_EVENT == event)
+		return "ZOO_DELETED_EVENT";
+	else if(ZOO_CHANGED_EVENT == event)
+		return "ZOO_CHANGED_EVENT";
+	else if(ZOO_SESSION_EVENT == event)
+		return "ZOO_SESSION_EVENT";
+	else if(ZOO_NOTWATCHING_EVENT == event) 
+		return "ZOO_NOTWATCHING_EVENT";
+	else
+		return "unknown event";
+}
+
+const char* stateStr(int state)
+{
+	if(ZOO_EXPIRED_SESSION_STATE == state)
+		return "ZOO_EXPIRED_SESSION_STATE";
+	else if(ZOO_AUTH_FAILED_STATE == state)
+		return "ZOO_AUTH_FAILED_STATE";
+	else if(ZOO_CONNECTING_STATE == state)
+		return "ZOO_CONNECTING_STATE";
+	else if(ZOO_ASSOCIATING_STATE == state)
+		return "ZOO_ASSOCIATING_STATE";
+	else if(ZOO_CONNECTED_STATE == state)
+		return "ZOO_CONNECTED_STATE";
+	else 
+		return "unknown state";
+}
+
+std::string parentPath(const std::string &path)
+{
+	if(path.empty())
+		return "";
+	//
+	size_t pos = path.rfind('/');
+	if(path.length()-1 == pos)
+	{
+		// skip the tail '/'
+		pos = path.rfind('/', pos-1);
+	}
+	if(string::npos == pos)
+	{
+		return "/"; //  parent path of "/" is also "/"
+	}
+	else
+	{
+		return path.substr(0, pos);
+	}
+}
+
+long long nowMicros()
+{
+#ifdef WIN32
+	LARGE_INTEGER freq, count;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&count);
+	return count.QuadPart * 1000000LL / freq.QuadPart;
+#else
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000000LL + tv.tv_usec;
+#endif
+}
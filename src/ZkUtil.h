@@ -0,0 +1,40 @@
+#ifndef _ZK_UTIL_H_
+#define _ZK_UTIL_H_
+
+// helpers shared by the threaded (ZooKeeper) and single-threaded (ZooKeeperLoop) wrappers,
+// for inner use only, do not include it in application code
+
+#include <zookeeper/zookeeper.h>
+#include <string>
+
+const char * errorStr(int code);
+const char * eventStr(int event);
+const char * stateStr(int state);
+std::string parentPath(const std::string &path);
+// monotonic enough for measuring
+long long nowMicros();
+
+// log, copied from zookeeper_log.h
+extern "C"
+{
+	extern ZOOAPI ZooLogLevel logLevel;
+#define LOGSTREAM getLogStream()
+
+#define LOG_ERROR(x) if(logLevel>=ZOO_LOG_LEVEL_ERROR) \
+	log_message(ZOO_LOG_LEVEL_ERROR,__LINE__,__func__,format_log_message x)
+#define LOG_WARN(x) if(logLevel>=ZOO_LOG_LEVEL_WARN) \
+	log_message(ZOO_LOG_LEVEL_WARN,__LINE__,__func__,format_log_message x)
+#define LOG_INFO(x) if(logLevel>=ZOO_LOG_LEVEL_INFO) \
+	log_message(ZOO_LOG_LEVEL_INFO,__LINE__,__func__,format_log_message x)
+#define LOG_DEBUG(x) if(logLevel==ZOO_LOG_LEVEL_DEBUG) \
+	log_message(ZOO_LOG_LEVEL_DEBUG,__LINE__,__func__,format_log_message x)
+
+	void log_message(ZooLogLevel curLevel, int line,const char* funcName,
+		const char* message);
+	const char* format_log_message(const char* format,...);
+	FILE* getLogStream();
+
+};
+//end log
+
+#endif
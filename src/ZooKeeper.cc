@@ -2,46 +2,21 @@
 #include <Windows.h>
 #else
 #include <unistd.h>
+#include <sys/time.h>
 #endif
 #include <assert.h>
 #include <sstream>
 #include <boost/bind.hpp>
+#include <boost/scoped_array.hpp>
 //#include <zookeeper/zookeeper_log.h>
 #include "ZooKeeper.h"
+#include "ZkUtil.h"
 
 using namespace std;
 
 #define ZK_RECV_TIMEOUT 15000
 #define ZK_BUFSIZE 10240
 
-static const char * errorStr(int code);
-static const char * eventStr(int event);
-static const char * stateStr(int state);
-static std::string parentPath(const std::string &path);
-
-// log, copied from zookeeper_log.h
-extern "C"
-{
-	extern ZOOAPI ZooLogLevel logLevel;
-#define LOGSTREAM getLogStream()
-
-#define LOG_ERROR(x) if(logLevel>=ZOO_LOG_LEVEL_ERROR) \
-	log_message(ZOO_LOG_LEVEL_ERROR,__LINE__,__func__,format_log_message x)
-#define LOG_WARN(x) if(logLevel>=ZOO_LOG_LEVEL_WARN) \
-	log_message(ZOO_LOG_LEVEL_WARN,__LINE__,__func__,format_log_message x)
-#define LOG_INFO(x) if(logLevel>=ZOO_LOG_LEVEL_INFO) \
-	log_message(ZOO_LOG_LEVEL_INFO,__LINE__,__func__,format_log_message x)
-#define LOG_DEBUG(x) if(logLevel==ZOO_LOG_LEVEL_DEBUG) \
-	log_message(ZOO_LOG_LEVEL_DEBUG,__LINE__,__func__,format_log_message x)
-
-	void log_message(ZooLogLevel curLevel, int line,const char* funcName,
-		const char* message);
-	const char* format_log_message(const char* format,...);
-	FILE* getLogStream();
-
-};
-//end log
-
 void ZooKeeper::defaultWatcher(zhandle_t *zh, int type, int state, const char *path, void *watcherCtx)
 {
 	if(type == ZOO_SESSION_EVENT)
@@ -58,6 +33,8 @@ void ZooKeeper::defaultWatcher(zhandle_t *zh, int type, int state, const char *p
 			// 
 			LOG_ERROR(("session expired"));
 //			LOG_DEBUG << "restart" << LOG_END;
+			zk->setConnected(false);
+			zk->markExpired();
 			zk->restart();
 		}
 		else
@@ -70,10 +47,31 @@ void ZooKeeper::defaultWatcher(zhandle_t *zh, int type, int state, const char *p
 	else if(type == ZOO_CREATED_EVENT)
 	{
 		LOG_DEBUG(("node created: %s", path));
+		// a watch waiting for its node
+		ZooKeeper *zk = static_cast<ZooKeeper*>(watcherCtx);
+		WatchPtr watches[] = {zk->watchPool_.getWatch<DataWatch>(path), zk->watchPool_.getWatch<ChildrenWatch>(path)};
+		for(size_t i = 0; i < sizeof(watches) / sizeof(watches[0]); ++i)
+		{
+			if(watches[i])
+			{
+				watches[i]->notify(watches[i]);
+			}
+		}
 	}
 	else if(type == ZOO_DELETED_EVENT)
 	{
 		LOG_DEBUG(("node deleted: %s", path));
+		// both watches of the node are triggered, the read of rearm waits for the node to come back
+		ZooKeeper *zk = static_cast<ZooKeeper*>(watcherCtx);
+		WatchPtr watches[] = {zk->watchPool_.getWatch<DataWatch>(path), zk->watchPool_.getWatch<ChildrenWatch>(path)};
+		for(size_t i = 0; i < sizeof(watches) / sizeof(watches[0]); ++i)
+		{
+			if(watches[i])
+			{
+				watches[i]->disarm();
+				watches[i]->notify(watches[i]);
+			}
+		}
 	}
 	else if(type == ZOO_CHANGED_EVENT)
 	{
@@ -81,7 +79,11 @@ void ZooKeeper::defaultWatcher(zhandle_t *zh, int type, int state, const char *p
 // 		LOG_DEBUG(("ZOO_CHANGED_EVENT"));
 // 		watch->getAndSet();
 		ZooKeeper *zk = static_cast<ZooKeeper*>(watcherCtx);
-		zk->watchPool_.getWatch<DataWatch>(path)->getAndSet();
+		WatchPtr wp = zk->watchPool_.getWatch<DataWatch>(path);
+		if(wp)
+		{
+			wp->notify(wp);
+		}
 	}
 	else if(type == ZOO_CHILD_EVENT)
 	{
@@ -89,7 +91,11 @@ void ZooKeeper::defaultWatcher(zhandle_t *zh, int type, int state, const char *p
 //		LOG_DEBUG(("ZOO_CHILDREN_EVENT"));
 //		watch->getAndSet();
 		ZooKeeper *zk = static_cast<ZooKeeper*>(watcherCtx);
-		zk->watchPool_.getWatch<ChildrenWatch>(path)->getAndSet();
+		WatchPtr wp = zk->watchPool_.getWatch<ChildrenWatch>(path);
+		if(wp)
+		{
+			wp->notify(wp);
+		}
 	}
 	else
 	{
@@ -100,9 +106,10 @@ void ZooKeeper::defaultWatcher(zhandle_t *zh, int type, int state, const char *p
 
 void ZooKeeper::dataCompletion(int rc, const char *value, int valueLen, const struct Stat *stat, const void *data)
 {
-	const DataWatch *watch = dynamic_cast<const DataWatch*>(static_cast<const Watch*>(data)); 
+	DataWatch *watch = dynamic_cast<DataWatch*>(static_cast<Watch*>(const_cast<void*>(data))); 
 	if(ZOK == rc)
 	{
+		watch->onVersion(stat->version);
 		watch->doCallback(string(value, valueLen));
 	}
 	else
@@ -112,15 +119,17 @@ void ZooKeeper::dataCompletion(int rc, const char *value, int valueLen, const st
 		// ZNONODE
 		// ZNOAUTH
 		LOG_ERROR(("data completion error, ret=%s, path=%s", errorStr(rc), watch->path().c_str()));
+		watch->onError(rc);
 	}
 	//
 }
 
-void ZooKeeper::stringsCompletion(int rc, const struct String_vector *strings, const void *data)
+void ZooKeeper::stringsCompletion(int rc, const struct String_vector *strings, const struct Stat *stat, const void *data)
 {
-	const ChildrenWatch *watch = dynamic_cast<const ChildrenWatch*>(static_cast<const Watch*>(data)); 
+	ChildrenWatch *watch = dynamic_cast<ChildrenWatch*>(static_cast<Watch*>(const_cast<void*>(data))); 
 	if(ZOK == rc)
 	{
+		watch->onVersion(stat->cversion);
 		vector<string> vecs;
 		for(int i = 0; i < strings->count; ++i)
 		{
@@ -135,13 +144,38 @@ void ZooKeeper::stringsCompletion(int rc, const struct String_vector *strings, c
 		// ZNONODE
 		// ZNOAUTH
 		LOG_ERROR(("strings completion error, ret=%s, path=%s", errorStr(rc), watch->path().c_str()));
+		watch->onError(rc);
+	}
+}
+
+void ZooKeeper::existsCompletion(int rc, const struct Stat *stat, const void *data)
+{
+	Watch *watch = static_cast<Watch*>(const_cast<void*>(data));
+	if(ZOK == rc)
+	{
+		// created before the exists watch was set
+		watch->rearm();
+	}
+	else if(ZNONODE != rc)
+	{
+		LOG_ERROR(("exists completion error, ret=%s, path=%s", errorStr(rc), watch->path().c_str()));
+		watch->onError(rc);
 	}
 }
 
 ZooKeeper::ZooKeeper()
 	: zhandle_ (NULL)
+	, handleUsers_ (0)
 	, connected_ (false)
 	, defaultLogLevel_ (ZOO_LOG_LEVEL_WARN)
+	, queueEnabled_ (false)
+	, queueCapacity_ (0)
+	, overflowPolicy_ (REJECT_NEW)
+	, closing_ (false)
+	, timerRunning_ (false)
+	, timerStopping_ (false)
+	, expiredAt_ (0)
+	, lastReregisterMicros_ (-1)
 	, logStream_ (stderr)
 {
 	setDebugLogLevel(false);
@@ -149,10 +183,23 @@ ZooKeeper::ZooKeeper()
 
 ZooKeeper::~ZooKeeper()
 {
-	if(zhandle_)
+	stopTimer();
+	{
+		ZkMutex::Guard guard(writeMutex_);
+		closing_ = true;
+	}
+	closeHandle();
+	// writes never sent
+	{
+		ZkMutex::Guard guard(writeMutex_);
+		while(!writeQueue_.empty())
+		{
+			finishWrite(writeQueue_.front(), ZCLOSING);
+		}
+	}
+	// sessions are closed at runtime by ZkSessionManager, never close stderr
+	if((logStream_ != NULL) && (logStream_ != stderr))
 	{
-		zookeeper_close(zhandle_);
-		zhandle_ = NULL;
 		fclose(logStream_);
 	}
 }
@@ -161,7 +208,12 @@ ZkRet ZooKeeper::init(const std::string &connectString)
 {
 	//
 	connectString_ = connectString;
-	zhandle_ = zookeeper_init(connectString.c_str(), defaultWatcher, ZK_RECV_TIMEOUT, NULL, this, 0);
+	{
+		// queued writes are flushed with zhandle_ when connected
+		ZkMutex::Guard guard(writeMutex_);
+		ZkMutex::Guard handleGuard(handleMutex_);
+		zhandle_ = zookeeper_init(connectString.c_str(), defaultWatcher, ZK_RECV_TIMEOUT, NULL, this, 0);
+	}
 	// 2s timeout
 	for(int i = 0; i < 2000; ++i)
 	{
@@ -176,11 +228,12 @@ ZkRet ZooKeeper::init(const std::string &connectString)
 
 void ZooKeeper::restart()
 {
-	if(NULL != zhandle_)
+	closeHandle();
 	{
-		zookeeper_close(zhandle_); 
+		ZkMutex::Guard guard(writeMutex_);
+		ZkMutex::Guard handleGuard(handleMutex_);
+		zhandle_ = zookeeper_init(connectString_.c_str(), defaultWatcher, ZK_RECV_TIMEOUT, NULL, this, 0);
 	}
-	zhandle_ = zookeeper_init(connectString_.c_str(), defaultWatcher, ZK_RECV_TIMEOUT, NULL, this, 0);
 	// 2s timeout
 	for(int i = 0; i < 2000; ++i)
 	{
@@ -192,15 +245,104 @@ void ZooKeeper::restart()
 			return;
 		}
 	}
-	zhandle_ = NULL;
+	{
+		ZkMutex::Guard guard(handleMutex_);
+		zhandle_ = NULL;
+	}
 	LOG_ERROR(("restart failed."));
 }
 
+ZooKeeper::HandleRef::HandleRef(ZooKeeper *zk)
+	: zk_ (zk)
+{
+	ZkMutex::Guard guard(zk_->handleMutex_);
+	zh_ = zk_->zhandle_;
+	if(NULL != zh_)
+	{
+		++zk_->handleUsers_;
+	}
+}
+
+ZooKeeper::HandleRef::~HandleRef()
+{
+	if(NULL == zh_)
+	{
+		return;
+	}
+	ZkMutex::Guard guard(zk_->handleMutex_);
+	if(0 == --zk_->handleUsers_)
+	{
+		zk_->handleCond_.notifyAll();
+	}
+}
+
+void ZooKeeper::closeHandle()
+{
+	zhandle_t *zh = NULL;
+	{
+		ZkMutex::Guard guard(handleMutex_);
+		zh = zhandle_;
+		zhandle_ = NULL;
+		// calls of other threads still in progress, a sync call returns soon as the session is closing or expired
+		while(handleUsers_ > 0)
+		{
+			handleCond_.wait(handleMutex_);
+		}
+	}
+	// it joins the zookeeper thread, so out of the lock
+	if(NULL != zh)
+	{
+		zookeeper_close(zh);
+	}
+}
+
+std::string ZooKeeper::currentServer()
+{
+	ZkMutex::Guard guard(handleMutex_);
+	if(NULL == zhandle_ || !connected_)
+	{
+		return "";
+	}
+	// it's formatted in a static buffer, copy it at once
+	const char *server = zoo_get_current_server(zhandle_);
+	return server ? server : "";
+}
+
+int ZooKeeper::setServers(const std::string &hosts)
+{
+	ZkMutex::Guard guard(handleMutex_);
+	if(NULL == zhandle_)
+	{
+		return ZINVALIDSTATE;
+	}
+	return zoo_set_servers(zhandle_, hosts.c_str());
+}
+
+void ZooKeeper::setConnected(bool connect/*=true*/)
+{
+	{
+		ZkMutex::Guard guard(writeMutex_);
+		connected_ = connect;
+		if(connect)
+		{
+			// replay parked writes
+			flushWrites();
+			reregisterEphemerals();
+		}
+	}
+	if(connect)
+	{
+		// the watches whose read failed while disconnected
+		watchPool_.armIdleAll();
+	}
+}
+
 ZkRet ZooKeeper::getData(const std::string &path, std::string &value)
 {
 	char buf[ZK_BUFSIZE] = {0};
 	int bufsize = sizeof(buf);
-	int ret = zoo_get(zhandle_, path.c_str(), false, buf, &bufsize, NULL);
+	HandleRef zh(this);
+	int ret = zoo_get(zh.get(), path.c_str(), false, buf, &bufsize, NULL);
 	if(ZOK != ret)
 	{
 		LOG_ERROR(("get %s failed, ret=%s", path.c_str(), errorStr(ret)));
@@ -214,7 +356,8 @@ ZkRet ZooKeeper::getData(const std::string &path, std::string &value)
 
 ZkRet ZooKeeper::setData(const std::string &path, const std::string &value)
 {
-	int ret = zoo_set(zhandle_, path.c_str(), value.c_str(), value.length(), -1);
+	HandleRef zh(this);
+	int ret = zoo_set(zh.get(), path.c_str(), value.c_str(), value.length(), -1);
 	if(ZOK != ret)
 	{
 		if(ZNONODE == ret)
@@ -230,6 +373,7 @@ ZkRet ZooKeeper::setData(const std::string &path, const std::string &value)
 	}
 	else
 	{
+		updateEphemeral(path, value);
 		return ZkRet(ret);
 	}
 }
@@ -237,7 +381,8 @@ ZkRet ZooKeeper::setData(const std::string &path, const std::string &value)
 ZkRet ZooKeeper::getChildren(const std::string &path, std::vector<std::string> &children)
 {
 	String_vector sv;
-	int ret = zoo_get_children(zhandle_, path.c_str(), false, &sv);
+	HandleRef zh(this);
+	int ret = zoo_get_children(zh.get(), path.c_str(), false, &sv);
 	if(ZOK != ret)
 	{
 		LOG_ERROR(("get children %s failed, ret=%s", path.c_str(), errorStr(ret)));
@@ -255,7 +400,8 @@ ZkRet ZooKeeper::getChildren(const std::string &path, std::vector<std::string> &
 
 ZkRet ZooKeeper::exists(const std::string &path)
 {
-	int ret = zoo_exists(zhandle_, path.c_str(), false, NULL);
+	HandleRef zh(this);
+	int ret = zoo_exists(zh.get(), path.c_str(), false, NULL);
 	return ZkRet(ret);
 }
 
@@ -266,7 +412,12 @@ ZkRet ZooKeeper::createNode(const std::string &path, const std::string &value, b
 
 ZkRet ZooKeeper::createEphemeralNode(const std::string &path, const std::string &value, bool recursive/*=true*/)
 {
-	return createTheNode(ZOO_EPHEMERAL, path, value, NULL, 0, recursive);
+	ZkRet zr = createTheNode(ZOO_EPHEMERAL, path, value, NULL, 0, recursive);
+	if(zr)
+	{
+		trackEphemeral(ZOO_EPHEMERAL, path, path, value, recursive);
+	}
+	return zr;
 }
 
 ZkRet ZooKeeper::createSequenceNode(const std::string &path, const std::string &value, std::string &rpath, bool recursive/*=true*/)
@@ -282,13 +433,62 @@ ZkRet ZooKeeper::createSequenceEphemeralNode(const std::string &path, const std:
 	char buf[ZK_BUFSIZE] = {0};
 	ZkRet zr = createTheNode(ZOO_SEQUENCE|ZOO_EPHEMERAL, path, value, buf, sizeof(buf), recursive);
 	rpath = buf;
+	if(zr)
+	{
+		trackEphemeral(ZOO_SEQUENCE|ZOO_EPHEMERAL, path, rpath, value, recursive);
+	}
 	return zr;
 }
 
+ZkRet ZooKeeper::createSequenceEphemeralNodes(const std::string &path, const std::string &value, size_t n, std::vector<std::string> &rpaths)
+{
+	if(0 == n)
+	{
+		return ZkRet(ZOK);
+	}
+	// the name is path plus a 10 digits sequence
+	size_t bufLen = path.length() + 16;
+	boost::scoped_array<zoo_op_t> ops(new zoo_op_t[n]);
+	boost::scoped_array<zoo_op_result_t> results(new zoo_op_result_t[n]);
+	boost::scoped_array<char> bufs(new char[n * bufLen]);
+	for(size_t i = 0; i < n; ++i)
+	{
+		zoo_create_op_init(&ops[i], path.c_str(), value.c_str(), value.length(), &ZOO_OPEN_ACL_UNSAFE, ZOO_SEQUENCE|ZOO_EPHEMERAL, &bufs[i * bufLen], (int)bufLen);
+	}
+	HandleRef zh(this);
+	int ret = zoo_multi(zh.get(), (int)n, ops.get(), results.get());
+	if(ZOK != ret)
+	{
+		LOG_ERROR(("create %lu nodes of %s failed, ret=%s", (unsigned long)n, path.c_str(), errorStr(ret)));
+		return ZkRet(ret);
+	}
+	for(size_t i = 0; i < n; ++i)
+	{
+		rpaths.push_back(&bufs[i * bufLen]);
+	}
+	return ZkRet(ZOK);
+}
+
+ZkRet ZooKeeper::deleteNode(const std::string &path)
+{
+	HandleRef zh(this);
+	int ret = zoo_delete(zh.get(), path.c_str(), -1);
+	if(ZOK == ret || ZNONODE == ret)
+	{
+		untrackEphemeral(path);
+	}
+	if(ZOK != ret)
+	{
+		LOG_ERROR(("delete %s failed, ret=%s", path.c_str(), errorStr(ret)));
+	}
+	return ZkRet(ret);
+}
+
 ZkRet ZooKeeper::createTheNode(int flag, const std::string &path, const std::string &value, char *rpath, int rpathlen, bool recursive)
 {
 	assert((NULL == rpath) || (flag & ZOO_SEQUENCE));
-	int ret = zoo_create(zhandle_, path.c_str(), value.c_str(), value.length(), &ZOO_OPEN_ACL_UNSAFE, flag, rpath, rpathlen);
+	HandleRef zh(this);
+	int ret = zoo_create(zh.get(), path.c_str(), value.c_str(), value.length(), &ZOO_OPEN_ACL_UNSAFE, flag, rpath, rpathlen);
 	if(ZNONODE == ret)
 	{
 		// create parent node
@@ -302,7 +502,7 @@ ZkRet ZooKeeper::createTheNode(int flag, const std::string &path, const std::str
 		if(zr.ok() || zr.nodeExist())
 		{
 			// if create parent node ok, then create this node
-			ret = zoo_create(zhandle_, path.c_str(), value.c_str(), value.length(), &ZOO_OPEN_ACL_UNSAFE, flag, rpath, rpathlen);
+			ret = zoo_create(zh.get(), path.c_str(), value.c_str(), value.length(), &ZOO_OPEN_ACL_UNSAFE, flag, rpath, rpathlen);
 			if(ZOK != ret && ZNODEEXISTS != ret)
 			{
 				LOG_ERROR(("create node failed, path=%s, ret=%s", path.c_str(), errorStr(ret)));
@@ -322,257 +522,1180 @@ ZkRet ZooKeeper::createTheNode(int flag, const std::string &path, const std::str
 }
 
 
-ZkRet ZooKeeper::watchData(const std::string &path, const DataWatchCallback &wc)
+ZkRet ZooKeeper::watchData(const std::string &path, const DataWatchCallback &wc, WatchId *id/*=NULL*/, const WatchOptions &options/*=WatchOptions()*/)
 {
 	ZkRet ex = exists(path);
 	if(!ex)
 	{
 		return ex;
 	}
-	WatchPtr wp = watchPool_.createWatch<DataWatch>(this, path, wc);
-	wp->getAndSet();
+	WatchId wid = watchPool_.createWatch<DataWatch>(this, path, wc, options);
+	if(id)
+	{
+		*id = wid;
+	}
 	return ZkRet(ZOK);
 }
 
-ZkRet ZooKeeper::watchChildren(const std::string &path, const ChildrenWatchCallback &wc)
+ZkRet ZooKeeper::watchChildren(const std::string &path, const ChildrenWatchCallback &wc, WatchId *id/*=NULL*/, const WatchOptions &options/*=WatchOptions()*/)
 {
 	ZkRet ex = exists(path);
 	if(!ex)
 	{
 		return ex;
 	}
-	WatchPtr wp = watchPool_.createWatch<ChildrenWatch>(this, path, wc);
-	wp->getAndSet();
+	WatchId wid = watchPool_.createWatch<ChildrenWatch>(this, path, wc, options);
+	if(id)
+	{
+		*id = wid;
+	}
 	return ZkRet(ZOK);
 }
 
-void ZooKeeper::setDebugLogLevel(bool open)
+ZkRet ZooKeeper::unwatchData(const std::string &path, WatchId id)
 {
-	ZooLogLevel loglevel = defaultLogLevel_;
-	if(open)
+	WatchPtr wp = watchPool_.getWatch<DataWatch>(path);
+	if(!wp || !wp->unsubscribe(id))
 	{
-		loglevel = ZOO_LOG_LEVEL_DEBUG;
+		return ZkRet(ZBADARGUMENTS);
 	}
-	zoo_set_debug_level(loglevel);
-}
-
-const char*  errorStr(int code)
-{
-	switch(code)
-	{
-	case ZOK:
-		return "Everything is OK";
-	case ZSYSTEMERROR:
-		return "System error";
-	case ZRUNTIMEINCONSISTENCY:
-		return "A runtime inconsistency was found";
-	case ZDATAINCONSISTENCY:
-		return "A data inconsistency was found";
-	case ZCONNECTIONLOSS:
-		return "Connection to the server has been lost";
-	case ZMARSHALLINGERROR:
-		return "Error while marshalling or unmarshalling data";
-	case ZUNIMPLEMENTED:
-		return "Operation is unimplemented";
-	case ZOPERATIONTIMEOUT:
-		return "Operation timeout";
-	case ZBADARGUMENTS:
-		return "Invalid arguments";
-	case ZINVALIDSTATE:
-		return "Invalid zhandle state";
-	case ZAPIERROR:
-		return "Api error";
-	case ZNONODE:
-		return "Node does not exist";
-	case ZNOAUTH:
-		return "Not authenticated";
-	case ZBADVERSION:
-		return "Version conflict";
-	case ZNOCHILDRENFOREPHEMERALS:
-		return "Ephemeral nodes may not have children";
-	case ZNODEEXISTS:
-		return "The node already exists";
-	case ZNOTEMPTY:
-		return "The node has children";
-	case ZSESSIONEXPIRED:
-		return "The session has been expired by the server";
-	case ZINVALIDCALLBACK:
-		return "Invalid callback specified";
-	case ZINVALIDACL:
-		return "Invalid ACL specified";
-	case ZAUTHFAILED:
-		return "Client authentication failed";
-	case ZCLOSING:
-		return "ZooKeeper is closing";
-	case ZNOTHING:
-		return "(not error) no server responses to process";
-	case ZSESSIONMOVED:
-		return "Session moved to another server, so operation is ignored";
-	default:
-		return "unknown error";
-	}
-}
-
-const char* eventStr(int event)
-{
-	if(ZOO_CREATED_EVENT == event)
-		return "ZOO_CREATED_EVENT";
-	else if(ZOO_DELETED_EVENT == event)
-		return "ZOO_DELETED_EVENT";
-	else if(ZOO_CHANGED_EVENT == event)
-		return "ZOO_CHANGED_EVENT";
-	else if(ZOO_SESSION_EVENT == event)
-		return "ZOO_SESSION_EVENT";
-	else if(ZOO_NOTWATCHING_EVENT == event) 
-		return "ZOO_NOTWATCHING_EVENT";
-	else
-		return "unknown event";
+	return ZkRet(ZOK);
 }
 
-const char* stateStr(int state)
+ZkRet ZooKeeper::unwatchChildren(const std::string &path, WatchId id)
 {
-	if(ZOO_EXPIRED_SESSION_STATE == state)
-		return "ZOO_EXPIRED_SESSION_STATE";
-	else if(ZOO_AUTH_FAILED_STATE == state)
-		return "ZOO_AUTH_FAILED_STATE";
-	else if(ZOO_CONNECTING_STATE == state)
-		return "ZOO_CONNECTING_STATE";
-	else if(ZOO_ASSOCIATING_STATE == state)
-		return "ZOO_ASSOCIATING_STATE";
-	else if(ZOO_CONNECTED_STATE == state)
-		return "ZOO_CONNECTED_STATE";
-	else 
-		return "unknown state";
+	WatchPtr wp = watchPool_.getWatch<ChildrenWatch>(path);
+	if(!wp || !wp->unsubscribe(id))
+	{
+		return ZkRet(ZBADARGUMENTS);
+	}
+	return ZkRet(ZOK);
 }
 
-std::string parentPath(const std::string &path)
+ZkRet ZooKeeper::dataWatchStats(const std::string &path, WatchStats &stats)
 {
-	if(path.empty())
-		return "";
-	//
-	size_t pos = path.rfind('/');
-	if(path.length()-1 == pos)
+	WatchPtr wp = watchPool_.getWatch<DataWatch>(path);
+	if(!wp)
 	{
-		// skip the tail '/'
-		pos = path.rfind('/', pos-1);
+		return ZkRet(ZBADARGUMENTS);
 	}
-	if(string::npos == pos)
-	{
-		return "/"; //  parent path of "/" is also "/"
-	}
-	else
+	stats = wp->stats();
+	return ZkRet(ZOK);
+}
+
+ZkRet ZooKeeper::childrenWatchStats(const std::string &path, WatchStats &stats)
+{
+	WatchPtr wp = watchPool_.getWatch<ChildrenWatch>(path);
+	if(!wp)
 	{
-		return path.substr(0, pos);
+		return ZkRet(ZBADARGUMENTS);
 	}
+	stats = wp->stats();
+	return ZkRet(ZOK);
 }
 
-// watch
+ZkFuture ZooKeeper::setDataQueued(const std::string &path, const std::string &value)
+{
+	return queueWrite(QueuedWrite::SET, 0, path, value, true);
+}
 
-ZooKeeper::Watch::Watch(ZooKeeper *zk, const std::string &path)
-	: zk_ (zk)
-	, path_ (path)
+ZkFuture ZooKeeper::createNodeQueued(const std::string &path, const std::string &value, bool recursive/*=true*/)
+{
+	return queueWrite(QueuedWrite::CREATE, 0, path, value, recursive);
+}
+
+ZkFuture ZooKeeper::createEphemeralNodeQueued(const std::string &path, const std::string &value, bool recursive/*=true*/)
 {
+	return queueWrite(QueuedWrite::CREATE, ZOO_EPHEMERAL, path, value, recursive);
+}
 
+ZkFuture ZooKeeper::deleteNodeQueued(const std::string &path)
+{
+	return queueWrite(QueuedWrite::DELETE, 0, path, "", false);
 }
 
-ZooKeeper::DataWatch::DataWatch(ZooKeeper *zk, const std::string &path, const CallbackType &cb)
-	: Watch (zk, path)
-	, cb_ (cb)
+void ZooKeeper::enableOfflineQueue(size_t capacity, OverflowPolicy policy/*=REJECT_NEW*/)
 {
+	ZkMutex::Guard guard(writeMutex_);
+	queueEnabled_ = true;
+	queueCapacity_ = capacity;
+	overflowPolicy_ = policy;
+}
 
+size_t ZooKeeper::offlineQueueSize()
+{
+	ZkMutex::Guard guard(writeMutex_);
+	return writeQueue_.size();
 }
 
-ZooKeeper::ChildrenWatch::ChildrenWatch(ZooKeeper *zk, const std::string &path, const CallbackType &cb)
-	: Watch (zk, path)
-	, cb_ (cb)
+ZkFuture ZooKeeper::queueWrite(QueuedWrite::Type type, int flag, const std::string &path, const std::string &value, bool recursive)
 {
+	ZkFuture future;
+	ZkMutex::Guard guard(writeMutex_);
+	if(!connected_ && !queueEnabled_)
+	{
+		future.set(ZCONNECTIONLOSS);
+		return future;
+	}
+	if(QueuedWrite::SET == type)
+	{
+		// coalesce with the last write of the same path, if it's a parked setData
+		for(WriteQueue::reverse_iterator it = writeQueue_.rbegin(); it != writeQueue_.rend(); ++it)
+		{
+			if(it->path == path)
+			{
+				if(QueuedWrite::SET == it->type && !it->inflight)
+				{
+					it->value = value;
+					it->futures.push_back(future);
+					return future;
+				}
+				break;
+			}
+		}
+	}
+	if(!connected_ && writeQueue_.size() >= queueCapacity_)
+	{
+		WriteQueue::iterator oldest = writeQueue_.begin();
+		while(writeQueue_.end() != oldest && oldest->inflight)
+		{
+			++oldest;
+		}
+		if(REJECT_NEW == overflowPolicy_ || writeQueue_.end() == oldest)
+		{
+			LOG_WARN(("offline queue is full, write rejected, path=%s", path.c_str()));
+			future.set(ZCONNECTIONLOSS);
+			return future;
+		}
+		LOG_WARN(("offline queue is full, write dropped, path=%s", oldest->path.c_str()));
+		finishWrite(*oldest, ZCONNECTIONLOSS);
+	}
+	QueuedWrite w;
+	w.zk = this;
+	w.type = type;
+	w.flag = flag;
+	w.path = path;
+	w.value = value;
+	w.recursive = recursive;
+	w.parentsSent = false;
+	w.inflight = false;
+	w.futures.push_back(future);
+	writeQueue_.push_back(w);
+	if(connected_)
+	{
+		flushWrites();
+	}
+	return future;
+}
 
+static bool isRetryable(int rc)
+{
+	return ZCONNECTIONLOSS == rc || ZOPERATIONTIMEOUT == rc || ZSESSIONEXPIRED == rc 
+		|| ZCLOSING == rc || ZINVALIDSTATE == rc;
 }
 
-void ZooKeeper::DataWatch::getAndSet() const
+// writeMutex_ must be held by the caller in the following functions 
+void ZooKeeper::flushWrites()
 {
-	int ret = zoo_awget(zk_->zhandle_, path_.c_str(), &ZooKeeper::defaultWatcher, this->zk(), &ZooKeeper::dataCompletion, this);
-	if(ZOK != ret)
+	WriteQueue::iterator it = writeQueue_.begin();
+	while(writeQueue_.end() != it)
 	{
-		// ZBADARGUMENTS
-		// ZINVALIDSTATE
-		// ZMARSHALLINGERROR
-		LOG_ERROR(("awget failed, path=%s, ret=%s", path_.c_str(), errorStr(ret)));
+		QueuedWrite &w = *it++;
+		if(w.inflight)
+		{
+			continue;
+		}
+		int ret = sendWrite(w);
+		if(ZOK != ret)
+		{
+			if(isRetryable(ret) && queueEnabled_)
+			{
+				// keep the rest in order, until connected again
+				break;
+			}
+			finishWrite(w, ret);
+		}
 	}
 }
 
-void ZooKeeper::ChildrenWatch::getAndSet() const
+int ZooKeeper::sendWrite(QueuedWrite &w)
 {
-	int ret = zoo_awget_children(zk_->zhandle_, path_.c_str(), &ZooKeeper::defaultWatcher, this->zk(), &ZooKeeper::stringsCompletion, this);
+	HandleRef zh(this);
+	int ret;
+	if(QueuedWrite::SET == w.type)
+	{
+		ret = zoo_aset(zh.get(), w.path.c_str(), w.value.c_str(), w.value.length(), -1, &ZooKeeper::writeStatCompletion, &w);
+	}
+	else if(QueuedWrite::DELETE == w.type)
+	{
+		ret = zoo_adelete(zh.get(), w.path.c_str(), -1, &ZooKeeper::writeVoidCompletion, &w);
+	}
+	else
+	{
+		ret = zoo_acreate(zh.get(), w.path.c_str(), w.value.c_str(), w.value.length(), &ZOO_OPEN_ACL_UNSAFE, w.flag, &ZooKeeper::writeStringCompletion, &w);
+	}
+	w.inflight = (ZOK == ret);
 	if(ZOK != ret)
 	{
-		LOG_ERROR(("awget_children failed, path=%s, ret=%s", path_.c_str(), errorStr(ret)));
+		LOG_ERROR(("send queued write failed, path=%s, ret=%s", w.path.c_str(), errorStr(ret)));
 	}
+	return ret;
 }
 
-ZkRet ZooKeeper::setFileLog(const std::string &dir /* = "./" */)
+void ZooKeeper::onWriteDone(QueuedWrite &w, int rc)
 {
-	if((logStream_ != NULL) && (logStream_ != stderr))
+	w.inflight = false;
+	if(ZNONODE == rc && QueuedWrite::SET == w.type)
 	{
-		fclose(logStream_);
+		// create it, but just a normal node, the same as setData
+		w.type = QueuedWrite::CREATE;
+		w.flag = 0;
+		w.recursive = true;
+		rc = sendWrite(w);
 	}
-	std::string filename(dir+"/zookeeper.log");
-	logStream_ = fopen(filename.c_str(), "w");
-	if(!logStream_)
+	else if(ZNONODE == rc && w.recursive && !w.parentsSent)
 	{
-		logStream_ = stderr;
-		return ZkRet(-1);
+		// create the parents, then this node again, requests of a session are handled in order, 
+		// so they are pipelined without waiting for each other
+		w.parentsSent = true;
+		vector<string> parents;
+		for(string ppath = parentPath(w.path); !ppath.empty() && ppath != "/"; ppath = parentPath(ppath))
+		{
+			parents.push_back(ppath);
+		}
+		HandleRef zh(this);
+		for(vector<string>::reverse_iterator it = parents.rbegin(); it != parents.rend(); ++it)
+		{
+			zoo_acreate(zh.get(), it->c_str(), "", 0, &ZOO_OPEN_ACL_UNSAFE, 0, &ZooKeeper::ignoreStringCompletion, NULL);
+		}
+		rc = sendWrite(w);
 	}
-	zoo_set_log_stream(logStream_);
-	return ZkRet(ZOK);
+	if(w.inflight)
+	{
+		return;
+	}
+	// the parents are sent again with the next attempt
+	w.parentsSent = false;
+	if(isRetryable(rc) && queueEnabled_ && !closing_)
+	{
+		// parked, replayed when connected again
+		LOG_DEBUG(("write parked, path=%s, ret=%s", w.path.c_str(), errorStr(rc)));
+		return;
+	}
+	if(ZOK != rc && ZNODEEXISTS != rc && !(ZNONODE == rc && QueuedWrite::DELETE == w.type))
+	{
+		LOG_ERROR(("queued write failed, path=%s, ret=%s", w.path.c_str(), errorStr(rc)));
+	}
+	finishWrite(w, rc);
 }
 
-ZkRet ZooKeeper::setConsoleLog()
+void ZooKeeper::finishWrite(QueuedWrite &w, int rc)
 {
-	if((logStream_ != NULL) && (logStream_ != stderr))
+	if(ZOK == rc && (w.flag & ZOO_EPHEMERAL))
 	{
-		fclose(logStream_);
+		trackEphemeral(w.flag, w.path, w.path, w.value, w.recursive);
+	}
+	else if(ZOK == rc && QueuedWrite::SET == w.type)
+	{
+		updateEphemeral(w.path, w.value);
+	}
+	else if((ZOK == rc || ZNONODE == rc) && QueuedWrite::DELETE == w.type)
+	{
+		untrackEphemeral(w.path);
+	}
+	for(size_t i = 0; i < w.futures.size(); ++i)
+	{
+		w.futures[i].set(rc);
+	}
+	// completions come in order, so it's almost always the first one
+	for(WriteQueue::iterator it = writeQueue_.begin(); it != writeQueue_.end(); ++it)
+	{
+		if(&*it == &w)
+		{
+			writeQueue_.erase(it);
+			break;
+		}
 	}
-	logStream_ = stderr;
-	zoo_set_log_stream(logStream_);
-	return ZkRet(ZOK);
 }
 
-void ZooKeeper::miliSleep(int milisec)
+void ZooKeeper::writeStatCompletion(int rc, const struct Stat *stat, const void *data)
 {
-#ifdef WIN32
-	Sleep(milisec);
-#else
-	usleep(milisec*1000);
-#endif
+	QueuedWrite *w = static_cast<QueuedWrite*>(const_cast<void*>(data));
+	ZooKeeper *zk = w->zk;
+	ZkMutex::Guard guard(zk->writeMutex_);
+	zk->onWriteDone(*w, rc);
 }
 
-std::string ZooKeeper::getParentPath(const std::string &path)
+void ZooKeeper::writeVoidCompletion(int rc, const void *data)
 {
+	QueuedWrite *w = static_cast<QueuedWrite*>(const_cast<void*>(data));
+	ZooKeeper *zk = w->zk;
+	ZkMutex::Guard guard(zk->writeMutex_);
+	zk->onWriteDone(*w, rc);
+}
 
-	int pos = path.rfind('/');
-	if(pos == path.npos)
-	{
-		return path;
-	}
-	if(pos == 0)
-	{
-		return "/";
-	}
-	return path.substr(0, pos);
+void ZooKeeper::writeStringCompletion(int rc, const char *value, const void *data)
+{
+	QueuedWrite *w = static_cast<QueuedWrite*>(const_cast<void*>(data));
+	ZooKeeper *zk = w->zk;
+	ZkMutex::Guard guard(zk->writeMutex_);
+	zk->onWriteDone(*w, rc);
 }
 
-std::string ZooKeeper::getNodeName(const std::string &path)
+void ZooKeeper::ignoreStringCompletion(int rc, const char *value, const void *data)
 {
-	int pos = path.rfind('/');
-	if(pos == path.npos)
+	if(ZOK != rc && ZNODEEXISTS != rc)
 	{
-		return path;
+		LOG_DEBUG(("create parent node failed, ret=%s", errorStr(rc)));
 	}
-	return path.substr(pos+1);
 }
 
-std::string ZooKeeper::getParentNodeName(const std::string &path)
+void ZooKeeper::setReregisterCallback(const ReregisterCallback &cb)
 {
-	return getNodeName(getParentPath(path));
-}
\ No newline at end of file
+	ZkMutex::Guard guard(ephemeralMutex_);
+	reregisterCb_ = cb;
+}
+
+long long ZooKeeper::lastReregisterMicros()
+{
+	ZkMutex::Guard guard(ephemeralMutex_);
+	return lastReregisterMicros_;
+}
+
+clientid_t ZooKeeper::clientId()
+{
+	clientid_t cid;
+	memset(&cid, 0, sizeof(cid));
+	ZkMutex::Guard guard(handleMutex_);
+	if(NULL != zhandle_)
+	{
+		const clientid_t *p = zoo_client_id(zhandle_);
+		if(p)
+		{
+			cid = *p;
+		}
+	}
+	return cid;
+}
+
+void ZooKeeper::trackEphemeral(int flag, const std::string &basePath, const std::string &path, const std::string &value, bool recursive)
+{
+	Ephemeral e;
+	e.zk = this;
+	e.path = path;
+	e.basePath = basePath;
+	e.value = value;
+	e.flag = flag;
+	e.recursive = recursive;
+	e.session = clientId().client_id;
+	e.sending = 0;
+	e.removed = false;
+	ZkMutex::Guard guard(ephemeralMutex_);
+	for(EphemeralList::iterator it = ephemerals_.begin(); it != ephemerals_.end(); ++it)
+	{
+		if(it->path == path && !it->removed)
+		{
+			it->value = value;
+			return;
+		}
+	}
+	ephemerals_.push_back(e);
+}
+
+void ZooKeeper::updateEphemeral(const std::string &path, const std::string &value)
+{
+	ZkMutex::Guard guard(ephemeralMutex_);
+	for(EphemeralList::iterator it = ephemerals_.begin(); it != ephemerals_.end(); ++it)
+	{
+		if(it->path == path)
+		{
+			it->value = value;
+		}
+	}
+}
+
+void ZooKeeper::untrackEphemeral(const std::string &path)
+{
+	ZkMutex::Guard guard(ephemeralMutex_);
+	EphemeralList::iterator it = ephemerals_.begin();
+	while(it != ephemerals_.end())
+	{
+		if(it->path != path)
+		{
+			++it;
+		}
+		else if(0 != it->sending)
+		{
+			// the completion refers to it, removed there
+			it->removed = true;
+			++it;
+		}
+		else
+		{
+			it = ephemerals_.erase(it);
+		}
+	}
+}
+
+void ZooKeeper::markExpired()
+{
+	ZkMutex::Guard guard(ephemeralMutex_);
+	expiredAt_ = nowMicros();
+}
+
+// called when connected, only nodes not created in the current session are sent
+void ZooKeeper::reregisterEphemerals()
+{
+	int64_t session = clientId().client_id;
+	ZkMutex::Guard guard(ephemeralMutex_);
+	for(EphemeralList::iterator it = ephemerals_.begin(); it != ephemerals_.end(); ++it)
+	{
+		if(it->session != session && 0 == it->sending && !it->removed)
+		{
+			sendEphemeral(*it, session);
+		}
+	}
+	checkReregistered();
+}
+
+// ephemeralMutex_ must be held by the caller
+void ZooKeeper::sendEphemeral(Ephemeral &e, int64_t session)
+{
+	HandleRef zh(this);
+	int ret = zoo_acreate(zh.get(), e.basePath.c_str(), e.value.c_str(), e.value.length(), &ZOO_OPEN_ACL_UNSAFE, e.flag, 
+		&ZooKeeper::ephemeralCompletion, &e);
+	if(ZOK == ret)
+	{
+		e.sending = session;
+	}
+	else
+	{
+		// tried again when connected next time
+		LOG_ERROR(("re-create ephemeral node failed, path=%s, ret=%s", e.basePath.c_str(), errorStr(ret)));
+	}
+}
+
+// ephemeralMutex_ must be held by the caller
+void ZooKeeper::checkReregistered()
+{
+	if(0 == expiredAt_)
+	{
+		return;
+	}
+	int64_t session = clientId().client_id;
+	for(EphemeralList::const_iterator it = ephemerals_.begin(); it != ephemerals_.end(); ++it)
+	{
+		if(it->session != session && !it->removed)
+		{
+			return;
+		}
+	}
+	lastReregisterMicros_ = nowMicros() - expiredAt_;
+	expiredAt_ = 0;
+	LOG_WARN(("ephemeral nodes re-created, count=%lu, micros=%lld", (unsigned long)ephemerals_.size(), lastReregisterMicros_));
+}
+
+void ZooKeeper::ephemeralCompletion(int rc, const char *value, const void *data)
+{
+	completeEphemeral(static_cast<Ephemeral*>(const_cast<void*>(data)), rc, value, false, 0);
+}
+
+void ZooKeeper::ephemeralOwnerCompletion(int rc, const struct Stat *stat, const void *data)
+{
+	completeEphemeral(static_cast<Ephemeral*>(const_cast<void*>(data)), rc, NULL, true, (ZOK == rc && stat) ? stat->ephemeralOwner : 0);
+}
+
+// checked is true for the result of the owner check of an existing node
+void ZooKeeper::completeEphemeral(Ephemeral *e, int rc, const char *value, bool checked, int64_t owner)
+{
+	ZooKeeper *zk = e->zk;
+	string oldPath;
+	string newPath;
+	ReregisterCallback cb;
+	{
+		ZkMutex::Guard guard(zk->ephemeralMutex_);
+		int64_t session = e->sending;
+		e->sending = 0;
+		if(e->removed)
+		{
+			// deleted by deleteNode while being created
+			if(ZOK == rc && value)
+			{
+				HandleRef zh(zk);
+				zoo_adelete(zh.get(), value, -1, &ZooKeeper::ephemeralDeleteCompletion, NULL);
+			}
+			for(EphemeralList::iterator it = zk->ephemerals_.begin(); it != zk->ephemerals_.end(); ++it)
+			{
+				if(&*it == e)
+				{
+					zk->ephemerals_.erase(it);
+					break;
+				}
+			}
+			zk->checkReregistered();
+			return;
+		}
+		if(ZNONODE == rc && e->recursive)
+		{
+			// create the parents, then this node again, pipelined
+			vector<string> parents;
+			for(string ppath = parentPath(e->basePath); !ppath.empty() && ppath != "/"; ppath = parentPath(ppath))
+			{
+				parents.push_back(ppath);
+			}
+			HandleRef zh(zk);
+			for(vector<string>::reverse_iterator it = parents.rbegin(); it != parents.rend(); ++it)
+			{
+				zoo_acreate(zh.get(), it->c_str(), "", 0, &ZOO_OPEN_ACL_UNSAFE, 0, &ZooKeeper::ignoreStringCompletion, NULL);
+			}
+			zk->sendEphemeral(*e, session);
+			if(0 != e->sending)
+			{
+				return;
+			}
+		}
+		if(checked && ZNONODE == rc)
+		{
+			// deleted by its owner meanwhile
+			zk->sendEphemeral(*e, session);
+			if(0 != e->sending)
+			{
+				return;
+			}
+		}
+		if(!checked && ZNODEEXISTS == rc && !(e->flag & ZOO_SEQUENCE))
+		{
+			// it's ours if the create was done before a connection loss, or it belongs to someone else
+			HandleRef zh(zk);
+			int ret = zoo_aexists(zh.get(), e->path.c_str(), 0, &ZooKeeper::ephemeralOwnerCompletion, e);
+			if(ZOK == ret)
+			{
+				e->sending = session;
+				return;
+			}
+			rc = ret;
+		}
+		if(checked && ZOK == rc && owner != session)
+		{
+			LOG_ERROR(("ephemeral node exists, owned by another session, path=%s, owner=%lld", e->path.c_str(), (long long)owner));
+			rc = ZNODEEXISTS;
+		}
+		oldPath = e->path;
+		newPath = e->path;
+		if(ZOK == rc)
+		{
+			e->session = session;
+			if(value)
+			{
+				e->path = newPath = value;
+			}
+		}
+		else
+		{
+			// tried again when connected next time
+			LOG_ERROR(("re-create ephemeral node failed, path=%s, ret=%s", e->basePath.c_str(), errorStr(rc)));
+		}
+		zk->checkReregistered();
+		cb = zk->reregisterCb_;
+	}
+	if(cb)
+	{
+		cb(oldPath, newPath, ZkRet(rc));
+	}
+}
+
+void ZooKeeper::ephemeralDeleteCompletion(int rc, const void *data)
+{
+	if(ZOK != rc && ZNONODE != rc)
+	{
+		LOG_ERROR(("delete ephemeral node failed, ret=%s", errorStr(rc)));
+	}
+}
+
+void ZooKeeper::setDebugLogLevel(bool open)
+{
+	ZooLogLevel loglevel = defaultLogLevel_;
+	if(open)
+	{
+		loglevel = ZOO_LOG_LEVEL_DEBUG;
+	}
+	zoo_set_debug_level(loglevel);
+}
+
+// watch
+
+ZooKeeper::Watch::Watch(ZooKeeper *zk, const std::string &path)
+	: zk_ (zk)
+	, path_ (path)
+	, armed_ (false)
+	, lastRead_ (0)
+	, scheduled_ (false)
+	, version_ (0)
+	, hasVersion_ (false)
+{
+
+}
+
+void ZooKeeper::Watch::rearm()
+{
+	bool arm = false;
+	{
+		ZkMutex::Guard guard(mutex_);
+		armed_ = arm = hasSubscriber();
+	}
+	if(arm)
+	{
+		getAndSet();
+	}
+	else
+	{
+		LOG_DEBUG(("no subscriber, watch dropped, path=%s", path_.c_str()));
+	}
+}
+
+void ZooKeeper::Watch::notify(const WatchPtr &self)
+{
+	long long due = 0;
+	{
+		ZkMutex::Guard guard(mutex_);
+		++stats_.events;
+		if(scheduled_)
+		{
+			// folded into the scheduled read
+			return;
+		}
+		long long now = nowMicros();
+		if(options_.debounce > 0)
+		{
+			due = now + options_.debounce * 1000LL;
+		}
+		else if(options_.minInterval > 0 && now < lastRead_ + options_.minInterval * 1000LL)
+		{
+			due = lastRead_ + options_.minInterval * 1000LL;
+		}
+		scheduled_ = (0 != due);
+	}
+	if(0 != due)
+	{
+		zk_->scheduleRearm(self, due);
+	}
+	else
+	{
+		rearm();
+	}
+}
+
+void ZooKeeper::Watch::fire()
+{
+	{
+		ZkMutex::Guard guard(mutex_);
+		scheduled_ = false;
+	}
+	rearm();
+}
+
+void ZooKeeper::Watch::armIdle()
+{
+	{
+		ZkMutex::Guard guard(mutex_);
+		if(armed_ || scheduled_ || !hasSubscriber())
+		{
+			return;
+		}
+		armed_ = true;
+	}
+	getAndSet();
+}
+
+void ZooKeeper::Watch::disarm()
+{
+	ZkMutex::Guard guard(mutex_);
+	armed_ = false;
+	clearValue();
+}
+
+void ZooKeeper::Watch::onError(int rc)
+{
+	bool exists = false;
+	{
+		ZkMutex::Guard guard(mutex_);
+		clearValue();
+		armed_ = exists = (ZNONODE == rc && hasSubscriber());
+	}
+	if(!exists)
+	{
+		// armed again by the next watch call or reconnection
+		return;
+	}
+	HandleRef zh(zk_);
+	int ret = zoo_awexists(zh.get(), path_.c_str(), &ZooKeeper::defaultWatcher, zk_, &ZooKeeper::existsCompletion, this);
+	if(ZOK != ret)
+	{
+		LOG_ERROR(("awexists failed, path=%s, ret=%s", path_.c_str(), errorStr(ret)));
+		disarm();
+	}
+}
+
+void ZooKeeper::Watch::markRead()
+{
+	ZkMutex::Guard guard(mutex_);
+	lastRead_ = nowMicros();
+	++stats_.reads;
+}
+
+void ZooKeeper::Watch::onVersion(int32_t version)
+{
+	ZkMutex::Guard guard(mutex_);
+	// the version restarts when the node is re-created
+	if(hasVersion_ && version > version_ + 1)
+	{
+		stats_.folded += version - version_ - 1;
+	}
+	version_ = version;
+	hasVersion_ = true;
+}
+
+void ZooKeeper::Watch::setOptions(const WatchOptions &options)
+{
+	ZkMutex::Guard guard(mutex_);
+	options_ = options;
+}
+
+ZooKeeper::WatchStats ZooKeeper::Watch::stats() const
+{
+	ZkMutex::Guard guard(mutex_);
+	return stats_;
+}
+
+ZooKeeper::DataWatch::DataWatch(ZooKeeper *zk, const std::string &path)
+	: FanoutWatch<DataWatchCallback, std::string> (zk, path)
+{
+
+}
+
+ZooKeeper::ChildrenWatch::ChildrenWatch(ZooKeeper *zk, const std::string &path)
+	: FanoutWatch<ChildrenWatchCallback, std::vector<std::string> > (zk, path)
+{
+
+}
+
+void ZooKeeper::DataWatch::getAndSet()
+{
+	markRead();
+	HandleRef zh(zk_);
+	int ret = zoo_awget(zh.get(), path_.c_str(), &ZooKeeper::defaultWatcher, this->zk(), &ZooKeeper::dataCompletion, this);
+	if(ZOK != ret)
+	{
+		// ZBADARGUMENTS
+		// ZINVALIDSTATE
+		// ZMARSHALLINGERROR
+		LOG_ERROR(("awget failed, path=%s, ret=%s", path_.c_str(), errorStr(ret)));
+		ZkMutex::Guard guard(mutex_);
+		armed_ = false;
+	}
+}
+
+void ZooKeeper::ChildrenWatch::getAndSet()
+{
+	markRead();
+	HandleRef zh(zk_);
+	int ret = zoo_awget_children2(zh.get(), path_.c_str(), &ZooKeeper::defaultWatcher, this->zk(), &ZooKeeper::stringsCompletion, this);
+	if(ZOK != ret)
+	{
+		LOG_ERROR(("awget_children2 failed, path=%s, ret=%s", path_.c_str(), errorStr(ret)));
+		ZkMutex::Guard guard(mutex_);
+		armed_ = false;
+	}
+}
+
+// timer
+
+void ZooKeeper::scheduleRearm(const WatchPtr &wp, long long due)
+{
+	ZkMutex::Guard guard(timerMutex_);
+	if(timerStopping_)
+	{
+		return;
+	}
+	if(!timerRunning_)
+	{
+		timerRunning_ = true;
+#ifdef WIN32
+		timerThread_ = CreateThread(NULL, 0, &ZooKeeper::timerMain, this, 0, NULL);
+#else
+		pthread_create(&timerThread_, NULL, &ZooKeeper::timerMain, this);
+#endif
+	}
+	timers_.insert(std::make_pair(due, wp));
+	timerCond_.notifyAll();
+}
+
+void ZooKeeper::stopTimer()
+{
+	{
+		ZkMutex::Guard guard(timerMutex_);
+		timerStopping_ = true;
+		timers_.clear();
+		timerCond_.notifyAll();
+		if(!timerRunning_)
+		{
+			return;
+		}
+	}
+#ifdef WIN32
+	WaitForSingleObject(timerThread_, INFINITE);
+	CloseHandle(timerThread_);
+#else
+	pthread_join(timerThread_, NULL);
+#endif
+}
+
+void ZooKeeper::runTimer()
+{
+	timerMutex_.lock();
+	while(!timerStopping_)
+	{
+		if(timers_.empty())
+		{
+			timerCond_.wait(timerMutex_);
+			continue;
+		}
+		long long now = nowMicros();
+		RearmTimers::iterator it = timers_.begin();
+		if(it->first > now)
+		{
+			timerCond_.wait(timerMutex_, static_cast<int>((it->first - now + 999) / 1000));
+			continue;
+		}
+		WatchPtr wp = it->second;
+		timers_.erase(it);
+		timerMutex_.unlock();
+		wp->fire();
+		timerMutex_.lock();
+	}
+	timerMutex_.unlock();
+}
+
+#ifdef WIN32
+DWORD WINAPI ZooKeeper::timerMain(LPVOID arg)
+{
+	static_cast<ZooKeeper*>(arg)->runTimer();
+	return 0;
+}
+#else
+void *ZooKeeper::timerMain(void *arg)
+{
+	static_cast<ZooKeeper*>(arg)->runTimer();
+	return NULL;
+}
+#endif
+
+ZkRet ZooKeeper::setFileLog(const std::string &dir /* = "./" */)
+{
+	if((logStream_ != NULL) && (logStream_ != stderr))
+	{
+		fclose(logStream_);
+	}
+	std::string filename(dir+"/zookeeper.log");
+	logStream_ = fopen(filename.c_str(), "w");
+	if(!logStream_)
+	{
+		logStream_ = stderr;
+		return ZkRet(-1);
+	}
+	zoo_set_log_stream(logStream_);
+	return ZkRet(ZOK);
+}
+
+ZkRet ZooKeeper::setConsoleLog()
+{
+	if((logStream_ != NULL) && (logStream_ != stderr))
+	{
+		fclose(logStream_);
+	}
+	logStream_ = stderr;
+	zoo_set_log_stream(logStream_);
+	return ZkRet(ZOK);
+}
+
+void ZooKeeper::miliSleep(int milisec)
+{
+#ifdef WIN32
+	Sleep(milisec);
+#else
+	usleep(milisec*1000);
+#endif
+}
+
+std::string ZooKeeper::getParentPath(const std::string &path)
+{
+
+	int pos = path.rfind('/');
+	if(pos == path.npos)
+	{
+		return path;
+	}
+	if(pos == 0)
+	{
+		return "/";
+	}
+	return path.substr(0, pos);
+}
+
+std::string ZooKeeper::getNodeName(const std::string &path)
+{
+	int pos = path.rfind('/');
+	if(pos == path.npos)
+	{
+		return path;
+	}
+	return path.substr(pos+1);
+}
+
+std::string ZooKeeper::getParentNodeName(const std::string &path)
+{
+	return getNodeName(getParentPath(path));
+}
+
+// future
+
+ZkFuture::ZkFuture()
+	: state_ (new State)
+{
+
+}
+
+bool ZkFuture::ready() const
+{
+	ZkMutex::Guard guard(state_->mutex);
+	return state_->ready;
+}
+
+ZkRet ZkFuture::get() const
+{
+	ZkMutex::Guard guard(state_->mutex);
+	while(!state_->ready)
+	{
+		state_->cond.wait(state_->mutex);
+	}
+	return ZkRet(state_->code);
+}
+
+bool ZkFuture::wait(int milisec) const
+{
+	ZkMutex::Guard guard(state_->mutex);
+	while(!state_->ready)
+	{
+		if(!state_->cond.wait(state_->mutex, milisec))
+		{
+			break;
+		}
+	}
+	return state_->ready;
+}
+
+void ZkFuture::set(int code) const
+{
+	ZkMutex::Guard guard(state_->mutex);
+	state_->code = code;
+	state_->ready = true;
+	state_->cond.notifyAll();
+}
+
+// condition
+
+#ifdef WIN32
+ZkCondition::ZkCondition()
+{
+	InitializeConditionVariable(&cond_);
+}
+
+ZkCondition::~ZkCondition()
+{
+
+}
+
+void ZkCondition::wait(ZkMutex &m)
+{
+	SleepConditionVariableCS(&cond_, &m.cs_, INFINITE);
+}
+
+bool ZkCondition::wait(ZkMutex &m, int milisec)
+{
+	return TRUE == SleepConditionVariableCS(&cond_, &m.cs_, milisec);
+}
+
+void ZkCondition::notifyAll()
+{
+	WakeAllConditionVariable(&cond_);
+}
+#else
+ZkCondition::ZkCondition()
+{
+	pthread_cond_init(&cond_, NULL);
+}
+
+ZkCondition::~ZkCondition()
+{
+	pthread_cond_destroy(&cond_);
+}
+
+void ZkCondition::wait(ZkMutex &m)
+{
+	pthread_cond_wait(&cond_, &m.mutex_);
+}
+
+bool ZkCondition::wait(ZkMutex &m, int milisec)
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	struct timespec abstime;
+	long long nsec = now.tv_usec * 1000LL + (milisec % 1000) * 1000000LL;
+	abstime.tv_sec = now.tv_sec + milisec / 1000 + nsec / 1000000000LL;
+	abstime.tv_nsec = nsec % 1000000000LL;
+	return 0 == pthread_cond_timedwait(&cond_, &m.mutex_, &abstime);
+}
+
+void ZkCondition::notifyAll()
+{
+	pthread_cond_broadcast(&cond_);
+}
+#endif
+
+// session manager
+
+ZkSessionManager &ZkSessionManager::instance()
+{
+	// never deleted, handles may be released after static objects are destroyed
+	static ZkSessionManager *mgr = new ZkSessionManager;
+	return *mgr;
+}
+
+ZkSessionManager::HandlePtr ZkSessionManager::acquire(const std::string &connectString)
+{
+	{
+		ZkMutex::Guard guard(mutex_);
+		boost::shared_ptr<ZooKeeper> zk = sessions_[connectString].lock();
+		if(zk)
+		{
+			return HandlePtr(new Handle(zk));
+		}
+	}
+	// init blocks until connected, other hosts are not held up meanwhile
+	boost::shared_ptr<ZooKeeper> zk(new ZooKeeper, boost::bind(&ZkSessionManager::release, this, connectString, _1));
+	if(!zk->init(connectString))
+	{
+		// the failed session is released out of the lock
+		LOG_ERROR(("init session failed, connectString=%s", connectString.c_str()));
+		return HandlePtr();
+	}
+	boost::shared_ptr<ZooKeeper> other;
+	{
+		ZkMutex::Guard guard(mutex_);
+		other = sessions_[connectString].lock();
+		if(!other)
+		{
+			sessions_[connectString] = zk;
+			return HandlePtr(new Handle(zk));
+		}
+	}
+	// a concurrent acquire of the same host won, ours is released out of the lock
+	return HandlePtr(new Handle(other));
+}
+
+size_t ZkSessionManager::sessionCount()
+{
+	ZkMutex::Guard guard(mutex_);
+	size_t count = 0;
+	for(SessionMap::const_iterator it = sessions_.begin(); it != sessions_.end(); ++it)
+	{
+		if(!it->second.expired())
+		{
+			++count;
+		}
+	}
+	return count;
+}
+
+void ZkSessionManager::release(const std::string &connectString, ZooKeeper *zk)
+{
+	{
+		ZkMutex::Guard guard(mutex_);
+		SessionMap::iterator itr = sessions_.find(connectString);
+		// it may have been replaced by a new session already
+		if(sessions_.end() != itr && itr->second.expired())
+		{
+			sessions_.erase(itr);
+		}
+	}
+	delete zk;
+}
+
+ZkSessionManager::Handle::Handle(const boost::shared_ptr<ZooKeeper> &zk)
+	: zk_ (zk)
+{
+
+}
+
+ZkSessionManager::Handle::~Handle()
+{
+	// before the session may be closed with zk_
+	for(Subscriptions::iterator it = dataSubs_.begin(); it != dataSubs_.end(); ++it)
+	{
+		zk_->unwatchData(it->second, it->first);
+	}
+	for(Subscriptions::iterator it = childrenSubs_.begin(); it != childrenSubs_.end(); ++it)
+	{
+		zk_->unwatchChildren(it->second, it->first);
+	}
+}
+
+ZkRet ZkSessionManager::Handle::watchData(const std::string &path, const DataWatchCallback &wc, ZooKeeper::WatchId *id/*=NULL*/, const ZooKeeper::WatchOptions &options/*=ZooKeeper::WatchOptions()*/)
+{
+	ZooKeeper::WatchId wid = 0;
+	ZkRet zr = zk_->watchData(path, wc, &wid, options);
+	if(zr)
+	{
+		ZkMutex::Guard guard(mutex_);
+		dataSubs_[wid] = path;
+		if(id)
+		{
+			*id = wid;
+		}
+	}
+	return zr;
+}
+
+ZkRet ZkSessionManager::Handle::watchChildren(const std::string &path, const ChildrenWatchCallback &wc, ZooKeeper::WatchId *id/*=NULL*/, const ZooKeeper::WatchOptions &options/*=ZooKeeper::WatchOptions()*/)
+{
+	ZooKeeper::WatchId wid = 0;
+	ZkRet zr = zk_->watchChildren(path, wc, &wid, options);
+	if(zr)
+	{
+		ZkMutex::Guard guard(mutex_);
+		childrenSubs_[wid] = path;
+		if(id)
+		{
+			*id = wid;
+		}
+	}
+	return zr;
+}
+
+ZkRet ZkSessionManager::Handle::unwatchData(const std::string &path, ZooKeeper::WatchId id)
+{
+	{
+		ZkMutex::Guard guard(mutex_);
+		dataSubs_.erase(id);
+	}
+	return zk_->unwatchData(path, id);
+}
+
+ZkRet ZkSessionManager::Handle::unwatchChildren(const std::string &path, ZooKeeper::WatchId id)
+{
+	{
+		ZkMutex::Guard guard(mutex_);
+		childrenSubs_.erase(id);
+	}
+	return zk_->unwatchChildren(path, id);
+}
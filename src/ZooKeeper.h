@@ -2,38 +2,145 @@
 #define _ZOOKEEPER_H_
 
 #include <zookeeper/zookeeper.h>
+#ifdef WIN32
+#include <Windows.h>
+#else
+#include <pthread.h>
+#endif
 #include <boost/function.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
 #include <boost/noncopyable.hpp>
 #include <stdio.h>
 #include <string>
 #include <vector>
 #include <map>
+#include <list>
 #include <sstream>
 #include <typeinfo>
 
 typedef boost::function<void (const std::string &path, const std::string &value)> DataWatchCallback;
 typedef boost::function<void (const std::string &path, const std::vector<std::string> &value)> ChildrenWatchCallback;
+// mutex, boost::mutex is not used because it needs the boost_thread library
+class ZkMutex : public boost::noncopyable
+{
+	friend class ZkCondition;
+public:
+#ifdef WIN32
+	ZkMutex(){InitializeCriticalSection(&cs_); }
+	~ZkMutex(){DeleteCriticalSection(&cs_); }
+	void lock(){EnterCriticalSection(&cs_); }
+	void unlock(){LeaveCriticalSection(&cs_); }
+#else
+	ZkMutex(){pthread_mutex_init(&mutex_, NULL); }
+	~ZkMutex(){pthread_mutex_destroy(&mutex_); }
+	void lock(){pthread_mutex_lock(&mutex_); }
+	void unlock(){pthread_mutex_unlock(&mutex_); }
+#endif
+	class Guard : public boost::noncopyable
+	{
+	public:
+		explicit Guard(ZkMutex &m) : m_ (m) {m_.lock(); }
+		~Guard(){m_.unlock(); }
+	private:
+		ZkMutex &m_;
+	};
+private:
+#ifdef WIN32
+	CRITICAL_SECTION cs_;
+#else
+	pthread_mutex_t mutex_;
+#endif
+};
+class ZkCondition : public boost::noncopyable
+{
+public:
+	ZkCondition();
+	~ZkCondition();
+	void wait(ZkMutex &m);
+	// return false if timeout
+	bool wait(ZkMutex &m, int milisec);
+	void notifyAll();
+private:
+#ifdef WIN32
+	CONDITION_VARIABLE cond_;
+#else
+	pthread_cond_t cond_;
+#endif
+};
 //
 class ZkRet
 {
 	friend class ZooKeeper;
+	friend class ZooKeeperLoop;
+	friend class ZkFuture;
 public:
+	// a zookeeper error code, for the recipes built on ZooKeeper
+	explicit ZkRet(int c){code_ = c; }
+	int code() const {return code_; }
 	bool ok() const {return ZOK == code_; }
 	bool nodeExist() const {return ZNODEEXISTS == code_; }
 	bool nodeNotExist() const {return ZNONODE == code_; }
 	operator bool() const {return ok(); }
 protected:
 	ZkRet(){code_ = ZOK; }
-	ZkRet(int c){code_ = c; }
 private:
 	int code_;
 };
+// result of a queued write, copies share the same result
+class ZkFuture
+{
+	friend class ZooKeeper;
+public:
+	ZkFuture();
+	bool ready() const;
+	// block until the write is done
+	ZkRet get() const;
+	// return false if timeout
+	bool wait(int milisec) const;
+private:
+	void set(int code) const;
+	struct State
+	{
+		State() : ready (false), code (ZOK) {}
+		ZkMutex mutex;
+		ZkCondition cond;
+		bool ready;
+		int code;
+	};
+	boost::shared_ptr<State> state_;
+};
 // class Zookeeper, 
-// thread safety: single ZooKeeper object should be used in single thread.
+// thread safety: single ZooKeeper object should be used in single thread, 
+// except that a session shared by ZkSessionManager can be used by several threads.
 class ZooKeeper : public boost::noncopyable
 {
 public:
+	typedef unsigned long WatchId;
+	// progress of exportTree/importTree, nodes and bytes done so far
+	typedef boost::function<void (size_t nodes, size_t bytes, double seconds)> ProgressCallback;
+	// an ephemeral node is re-created in a new session, newPath differs from oldPath for sequence nodes
+	typedef boost::function<void (const std::string &oldPath, const std::string &newPath, const ZkRet &ret)> ReregisterCallback;
+	// what to do when the offline write queue is full
+	enum OverflowPolicy
+	{
+		REJECT_NEW,  // the new write fails with ZCONNECTIONLOSS at once
+		DROP_OLDEST  // the oldest parked write fails with ZCONNECTIONLOSS
+	};
+	// coalescing of a watched path, in miliseconds, 0 to disable. changes in between fold into one read of the latest state.
+	struct WatchOptions
+	{
+		explicit WatchOptions(int minInterval = 0, int debounce = 0) : minInterval (minInterval), debounce (debounce) {}
+		int minInterval; // a change is read at once, but no sooner than minInterval after the last read
+		int debounce;    // a change is read debounce after it is notified, on the trailing edge
+	};
+	struct WatchStats
+	{
+		WatchStats() : events (0), reads (0), folded (0) {}
+		unsigned long events; // notifications from the server
+		unsigned long reads;  // reads sent
+		unsigned long folded; // versions never read on their own, saved by coalescing
+	};
 	ZooKeeper();
 	~ZooKeeper();
 	//
@@ -48,8 +155,50 @@ public:
 	// sequence node, the created node's name is not equal to the given path, it is like "path-xx", xx is an auto-increment number 
 	ZkRet createSequenceNode(const std::string &path, const std::string &value, std::string &rpath, bool recursive = true);
 	ZkRet createSequenceEphemeralNode(const std::string &path, const std::string &value, std::string &rpath, bool recursive = true);
-	ZkRet watchData(const std::string &path, const DataWatchCallback &wc);
-	ZkRet watchChildren(const std::string &path, const ChildrenWatchCallback &wc);
+	// n sequence ephemeral nodes in one transaction, all or none, the parent must exist.
+	// unlike createSequenceEphemeralNode, they are not re-created in a new session
+	ZkRet createSequenceEphemeralNodes(const std::string &path, const std::string &value, size_t n, std::vector<std::string> &rpaths);
+	ZkRet deleteNode(const std::string &path);
+	// ephemeral nodes created by this object, and their data, are re-created as soon as a new session
+	// is connected after the old one expired, all in one pipelined batch. delete them by deleteNode to stop it.
+	void setReregisterCallback(const ReregisterCallback &cb);
+	// microseconds from the last session expiry to all ephemeral nodes re-created, -1 if never
+	long long lastReregisterMicros();
+	// id and password of the current session, another handle inited with it takes the session over
+	clientid_t clientId();
+	// "ip:port" of the server connected, empty if not connected
+	std::string currentServer();
+	// replace the server list, the session may be moved to another server of the new list
+	int setServers(const std::string &hosts);
+	// queued writes, they are sent asynchronously and the result is got from the future.
+	// if the offline queue is enabled, writes are parked while disconnected, instead of failing with ZCONNECTIONLOSS, 
+	// and replayed in order, pipelined, when connected again. only idempotent writes can be queued.
+	// a parked setData is overwritten by a later setData to the same path.
+	ZkFuture setDataQueued(const std::string &path, const std::string &value);
+	ZkFuture createNodeQueued(const std::string &path, const std::string &value, bool recursive = true);
+	ZkFuture createEphemeralNodeQueued(const std::string &path, const std::string &value, bool recursive = true);
+	// any version, ZNONODE if it's already gone. safe to call in a callback, unlike the synchronous functions
+	ZkFuture deleteNodeQueued(const std::string &path);
+	// opt-in, at most capacity writes are kept
+	void enableOfflineQueue(size_t capacity, OverflowPolicy policy = REJECT_NEW);
+	size_t offlineQueueSize();
+	// a path is watched on the server only once, no matter how many callbacks are subscribed to it,
+	// pass id to get the subscription id for unwatchData/unwatchChildren
+	// options are per path, shared by all subscribers, and replaced by a later watch with non-default options
+	ZkRet watchData(const std::string &path, const DataWatchCallback &wc, WatchId *id = NULL, const WatchOptions &options = WatchOptions());
+	ZkRet watchChildren(const std::string &path, const ChildrenWatchCallback &wc, WatchId *id = NULL, const WatchOptions &options = WatchOptions());
+	ZkRet dataWatchStats(const std::string &path, WatchStats &stats);
+	ZkRet childrenWatchStats(const std::string &path, WatchStats &stats);
+	// remove a subscriber, the server side watch is dropped when it is triggered next time without subscribers
+	ZkRet unwatchData(const std::string &path, WatchId id);
+	ZkRet unwatchChildren(const std::string &path, WatchId id);
+	// back up the subtree of root to file, breadth-first, with at most window reads in flight.
+	// ephemeral nodes and /zookeeper are skipped.
+	ZkRet exportTree(const std::string &root, const std::string &file, const ProgressCallback &progress = ProgressCallback(), int window = 256);
+	// restore a subtree exported by exportTree under root, parents before children, batchSize nodes per zoo_multi.
+	// existing nodes get the data in file. the imported count is checkpointed in "file.progress" with root and checksum,
+	// and if resume is true, the nodes imported by a failed import of the same file to the same root are skipped.
+	ZkRet importTree(const std::string &file, const std::string &root, bool resume = true, const ProgressCallback &progress = ProgressCallback(), int batchSize = 200);
 	//
 	void setDebugLogLevel(bool open = true);
 	//
@@ -61,68 +210,195 @@ public:
 	static std::string getParentNodeName(const std::string &path);
 private:
 	// for inner use, you should never call these function
-	void setConnected(bool connect = true){connected_ = connect; }
+	void setConnected(bool connect = true);
 	bool connected()const{return connected_; }
 	void restart();
 	//
 	// watch class
+	// one server side watch per path, fanned out to any number of subscribers
 	class Watch
 	{
 	public:
 		Watch(ZooKeeper *zk, const std::string &path);
-		virtual void getAndSet() const = 0;
+		virtual ~Watch(){}
+		virtual void getAndSet() = 0;
+		virtual bool unsubscribe(WatchId id) = 0;
+		// arm the server side watch again if anyone still subscribes, 
+		// called when it is triggered or the session is renewed
+		void rearm();
+		// the server side watch is triggered, rearm now or later by the options
+		void notify(const boost::shared_ptr<Watch> &self);
+		// the scheduled rearm is due
+		void fire();
+		// arm it if it has subscribers but no server side watch, after a failed read
+		void armIdle();
+		// the server side watch is gone with the node, the cached value too
+		void disarm();
+		// the read failed, wait for the node to be created if it is gone, or disarm
+		void onError(int rc);
+		// count the versions skipped since the last read
+		void onVersion(int32_t version);
+		void setOptions(const WatchOptions &options);
+		WatchStats stats() const;
 		const std::string &path() const{return path_; }
 		ZooKeeper* zk() const {return zk_; }
 	protected:
+		virtual bool hasSubscriber() const = 0;
+		// called with mutex_ held
+		virtual void clearValue() = 0;
+		void markRead();
 		ZooKeeper *zk_;
 		std::string path_;
+		mutable ZkMutex mutex_;
+		bool armed_;
+		WatchOptions options_;
+		WatchStats stats_;
+		long long lastRead_;
+		bool scheduled_;
+		int32_t version_;
+		bool hasVersion_;
 	};
 	typedef boost::shared_ptr<Watch> WatchPtr;
-	class DataWatch: public Watch
+	template<class Callback, class Value>
+	class FanoutWatch: public Watch
 	{
 	public:
-		typedef DataWatchCallback CallbackType;
-		DataWatch(ZooKeeper *zk, const std::string &path, const CallbackType &cb);
-		virtual void getAndSet() const;
-		void doCallback(const std::string &data) const{ cb_ (path_, data); };
+		typedef Callback CallbackType;
+		FanoutWatch(ZooKeeper *zk, const std::string &path) : Watch(zk, path), hasValue_ (false), delivering_ (false) {}
+		// the new subscriber gets the last value at once if there is one
+		void subscribe(WatchId id, const CallbackType &cb)
+		{
+			bool arm = false;
+			{
+				ZkMutex::Guard guard(mutex_);
+				subscribers_[id] = cb;
+				if(!armed_)
+				{
+					armed_ = arm = true;
+				}
+				else if(hasValue_)
+				{
+					Subscribers sub;
+					sub[id] = cb;
+					pending_.push_back(Delivery(sub, value_));
+				}
+			}
+			if(arm)
+			{
+				getAndSet();
+			}
+			else
+			{
+				deliver();
+			}
+		}
+		virtual bool unsubscribe(WatchId id)
+		{
+			ZkMutex::Guard guard(mutex_);
+			return subscribers_.erase(id) > 0;
+		}
+		void doCallback(const Value &value)
+		{
+			{
+				ZkMutex::Guard guard(mutex_);
+				value_ = value;
+				hasValue_ = true;
+				pending_.push_back(Delivery(subscribers_, value));
+			}
+			deliver();
+		}
+	protected:
+		virtual void clearValue()
+		{
+			value_ = Value();
+			hasValue_ = false;
+		}
 	private:
-		CallbackType cb_;
+		typedef std::map<WatchId, CallbackType> Subscribers;
+		typedef std::pair<Subscribers, Value> Delivery;
+		// values are delivered in order, by one thread at a time, and out of the lock,
+		// so that a callback can subscribe or unsubscribe
+		void deliver()
+		{
+			Delivery d;
+			for(;;)
+			{
+				{
+					ZkMutex::Guard guard(mutex_);
+					if(delivering_ || pending_.empty())
+					{
+						return;
+					}
+					delivering_ = true;
+					d = pending_.front();
+					pending_.pop_front();
+				}
+				for(typename Subscribers::const_iterator it = d.first.begin(); it != d.first.end(); ++it)
+				{
+					it->second(path_, d.second);
+				}
+				ZkMutex::Guard guard(mutex_);
+				delivering_ = false;
+			}
+		}
+		virtual bool hasSubscriber() const {return !subscribers_.empty(); }
+		Subscribers subscribers_;
+		Value value_;
+		bool hasValue_;
+		std::list<Delivery> pending_;
+		bool delivering_;
+	};
+	class DataWatch: public FanoutWatch<DataWatchCallback, std::string>
+	{
+	public:
+		DataWatch(ZooKeeper *zk, const std::string &path);
+		virtual void getAndSet();
 	};
 
-	class ChildrenWatch: public Watch
+	class ChildrenWatch: public FanoutWatch<ChildrenWatchCallback, std::vector<std::string> >
 	{
 	public:
-		typedef ChildrenWatchCallback CallbackType;
-		ChildrenWatch(ZooKeeper *zk, const std::string &path, const CallbackType &cb);
-		virtual void getAndSet() const;
-		void doCallback(const std::vector<std::string> &data) const { cb_ (path_, data); };
-	private:
-		CallbackType cb_;
+		ChildrenWatch(ZooKeeper *zk, const std::string &path);
+		virtual void getAndSet();
 	};
 	//
 	class WatchPool
 	{
 	public:
+		WatchPool() : nextId_ (0) {}
 		template<class T>
-		WatchPtr createWatch(ZooKeeper *zk, const std::string &path, const typename T::CallbackType &cb)
+		WatchId createWatch(ZooKeeper *zk, const std::string &path, const typename T::CallbackType &cb, const WatchOptions &options)
 		{
 			std::string name = typeid(T).name() + path;
-			WatchMap::iterator itr = watchMap_.find(name);
-			if(watchMap_.end() == itr)
+			boost::shared_ptr<T> wp;
+			WatchId id;
 			{
-				WatchPtr wp(new T(zk, path, cb));
-				watchMap_[name] = wp;
-				return wp;
+				ZkMutex::Guard guard(mutex_);
+				WatchMap::iterator itr = watchMap_.find(name);
+				if(watchMap_.end() == itr)
+				{
+					wp.reset(new T(zk, path));
+					watchMap_[name] = wp;
+				}
+				else
+				{
+					wp = boost::static_pointer_cast<T>(itr->second);
+				}
+				id = ++nextId_;
 			}
-			else
+			if(options.minInterval > 0 || options.debounce > 0)
 			{
-				return itr->second;
+				wp->setOptions(options);
 			}
+			wp->subscribe(id, cb);
+			return id;
 		}
+		// watches are never removed from the pool, completions may still refer to them
 		template<class T>
 		WatchPtr getWatch(const std::string &path)
 		{
 			std::string name = typeid(T).name() + path;
+			ZkMutex::Guard guard(mutex_);
 			WatchMap::iterator itr = watchMap_.find(name);
 			if(watchMap_.end() == itr)
 			{
@@ -134,34 +410,205 @@ private:
 			}
 		}
 		//
-		void getAndSetAll() const
+		void getAndSetAll()
 		{
-			for(WatchMap::const_iterator it = watchMap_.begin(); it != watchMap_.end(); ++it)
+			std::vector<WatchPtr> watches;
+			{
+				ZkMutex::Guard guard(mutex_);
+				for(WatchMap::const_iterator it = watchMap_.begin(); it != watchMap_.end(); ++it)
+				{
+					watches.push_back(it->second);
+				}
+			}
+			for(size_t i = 0; i < watches.size(); ++i)
 			{
-				it->second->getAndSet();
+				watches[i]->rearm();
+			}
+		}
+		void armIdleAll()
+		{
+			std::vector<WatchPtr> watches;
+			{
+				ZkMutex::Guard guard(mutex_);
+				for(WatchMap::const_iterator it = watchMap_.begin(); it != watchMap_.end(); ++it)
+				{
+					watches.push_back(it->second);
+				}
+			}
+			for(size_t i = 0; i < watches.size(); ++i)
+			{
+				watches[i]->armIdle();
 			}
 		}
 	private:
 		typedef std::map<std::string, WatchPtr> WatchMap;
 		WatchMap watchMap_;
+		WatchId nextId_;
+		ZkMutex mutex_;
 	};
 	//
 	static void dataCompletion(int rc, const char *value, int valueLen, const struct Stat *stat, const void *data);
-	static void stringsCompletion(int rc, const struct String_vector *strings, const void *data);
+	static void stringsCompletion(int rc, const struct String_vector *strings, const struct Stat *stat, const void *data);
+	static void existsCompletion(int rc, const struct Stat *stat, const void *data);
 	static void defaultWatcher(zhandle_t *zh, int type, int state, const char *path,void *watcherCtx);
 	//
+	// delayed rearms of coalesced watches, run in a timer thread started on first use
+	typedef std::multimap<long long, WatchPtr> RearmTimers;
+	void scheduleRearm(const WatchPtr &wp, long long due);
+	void stopTimer();
+	void runTimer();
+#ifdef WIN32
+	static DWORD WINAPI timerMain(LPVOID arg);
+#else
+	static void *timerMain(void *arg);
+#endif
+	//
+	// queued write, it stays in writeQueue_ until it's done
+	struct QueuedWrite
+	{
+		enum Type {SET, CREATE, DELETE};
+		ZooKeeper *zk;
+		Type type;
+		int flag;
+		std::string path;
+		std::string value;
+		bool recursive;
+		bool parentsSent;     // the parents are created ahead of this attempt
+		bool inflight;
+		std::vector<ZkFuture> futures; // more than one if coalesced
+	};
+	typedef std::list<QueuedWrite> WriteQueue;
+	ZkFuture queueWrite(QueuedWrite::Type type, int flag, const std::string &path, const std::string &value, bool recursive);
+	void flushWrites();
+	int sendWrite(QueuedWrite &w);
+	void finishWrite(QueuedWrite &w, int rc);
+	void onWriteDone(QueuedWrite &w, int rc);
+	static void writeStatCompletion(int rc, const struct Stat *stat, const void *data);
+	static void writeVoidCompletion(int rc, const void *data);
+	static void writeStringCompletion(int rc, const char *value, const void *data);
+	static void ignoreStringCompletion(int rc, const char *value, const void *data);
+	//
+	// ephemeral node owned by this object
+	struct Ephemeral
+	{
+		ZooKeeper *zk;
+		std::string path;     // the created path, differs from basePath for sequence nodes
+		std::string basePath;
+		std::string value;
+		int flag;
+		bool recursive;
+		int64_t session;      // the session it is created in
+		int64_t sending;      // the session it is being created in, 0 if not in flight
+		bool removed;         // deleted while being created
+	};
+	typedef std::list<Ephemeral> EphemeralList;
+	void trackEphemeral(int flag, const std::string &basePath, const std::string &path, const std::string &value, bool recursive);
+	void updateEphemeral(const std::string &path, const std::string &value);
+	void untrackEphemeral(const std::string &path);
+	void markExpired();
+	void reregisterEphemerals();
+	void sendEphemeral(Ephemeral &e, int64_t session);
+	void checkReregistered();
+	static void ephemeralCompletion(int rc, const char *value, const void *data);
+	static void ephemeralOwnerCompletion(int rc, const struct Stat *stat, const void *data);
+	static void completeEphemeral(Ephemeral *e, int rc, const char *value, bool checked, int64_t owner);
+	static void ephemeralDeleteCompletion(int rc, const void *data);
+	//
 	ZkRet createTheNode(int flag, const std::string &path, const std::string &value, char *rpath, int rpathlen, bool recursive);
 	//
 	void miliSleep(int milisec);
 	//
+	// pins zhandle_ for the calls of one scope, a replaced handle is closed when no call is using it
+	class HandleRef : public boost::noncopyable
+	{
+	public:
+		explicit HandleRef(ZooKeeper *zk);
+		~HandleRef();
+		zhandle_t *get()const{return zh_; }
+	private:
+		ZooKeeper *zk_;
+		zhandle_t *zh_;
+	};
+	// take zhandle_ away and close it when it's not used anymore
+	void closeHandle();
+	//
 	zhandle_t *zhandle_;
+	// held while zhandle_ is read or replaced, never across a call into the zookeeper library
+	ZkMutex handleMutex_;
+	ZkCondition handleCond_;
+	int handleUsers_;
 	std::string connectString_;
 	bool connected_;
 	ZooLogLevel defaultLogLevel_;
 	WatchPool watchPool_;
+	// offline write queue
+	WriteQueue writeQueue_;
+	ZkMutex writeMutex_;
+	bool queueEnabled_;
+	size_t queueCapacity_;
+	OverflowPolicy overflowPolicy_;
+	bool closing_;
+	// timer thread
+	RearmTimers timers_;
+	ZkMutex timerMutex_;
+	ZkCondition timerCond_;
+	bool timerRunning_;
+	bool timerStopping_;
+#ifdef WIN32
+	HANDLE timerThread_;
+#else
+	pthread_t timerThread_;
+#endif
+	// ephemeral nodes to re-create
+	EphemeralList ephemerals_;
+	ZkMutex ephemeralMutex_;
+	ReregisterCallback reregisterCb_;
+	long long expiredAt_;
+	long long lastReregisterMicros_;
 	//
 	FILE *logStream_;
 };
 
+// class ZkSessionManager, process-wide registry of shared ZooKeeper sessions.
+// every module acquires its own handle, handles of the same connect string share one session,
+// and the session is closed when the last handle is released.
+class ZkSessionManager : public boost::noncopyable
+{
+public:
+	// handle of one module, the subscriptions made through it are unwatched when it is destroyed
+	class Handle : public boost::noncopyable
+	{
+	public:
+		~Handle();
+		// the shared session, subscribe through the handle instead of the session
+		ZooKeeper &zk()const{return *zk_; }
+		ZkRet watchData(const std::string &path, const DataWatchCallback &wc, ZooKeeper::WatchId *id = NULL, const ZooKeeper::WatchOptions &options = ZooKeeper::WatchOptions());
+		ZkRet watchChildren(const std::string &path, const ChildrenWatchCallback &wc, ZooKeeper::WatchId *id = NULL, const ZooKeeper::WatchOptions &options = ZooKeeper::WatchOptions());
+		ZkRet unwatchData(const std::string &path, ZooKeeper::WatchId id);
+		ZkRet unwatchChildren(const std::string &path, ZooKeeper::WatchId id);
+	private:
+		friend class ZkSessionManager;
+		explicit Handle(const boost::shared_ptr<ZooKeeper> &zk);
+		//
+		boost::shared_ptr<ZooKeeper> zk_;
+		// subscription id -> path
+		typedef std::map<ZooKeeper::WatchId, std::string> Subscriptions;
+		Subscriptions dataSubs_;
+		Subscriptions childrenSubs_;
+		ZkMutex mutex_;
+	};
+	typedef boost::shared_ptr<Handle> HandlePtr;
+	static ZkSessionManager &instance();
+	// return an empty handle if a new session can not be connected
+	HandlePtr acquire(const std::string &connectString);
+	size_t sessionCount();
+private:
+	ZkSessionManager(){}
+	void release(const std::string &connectString, ZooKeeper *zk);
+	//
+	typedef std::map<std::string, boost::weak_ptr<ZooKeeper> > SessionMap;
+	SessionMap sessions_;
+	ZkMutex mutex_;
+};
 
 #endif
\ No newline at end of file
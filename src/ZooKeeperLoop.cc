@@ -0,0 +1,538 @@
+#include <assert.h>
+#include <boost/bind.hpp>
+#include "ZooKeeperLoop.h"
+#include "ZkUtil.h"
+
+using namespace std;
+
+#define ZK_RECV_TIMEOUT 15000
+
+void ZooKeeperLoop::sessionWatcher(zhandle_t *zh, int type, int state, const char *path, void *watcherCtx)
+{
+	ZooKeeperLoop *zk = static_cast<ZooKeeperLoop*>(watcherCtx);
+	if(type == ZOO_SESSION_EVENT)
+	{
+		if(state == ZOO_CONNECTED_STATE)
+		{
+			zk->connected_ = true;
+			LOG_DEBUG(("connected, session state: %s", stateStr(state)));
+			if(zk->rearm_)
+			{
+				// a new session, watches of the expired one are lost
+				zk->rearm_ = false;
+				zk->armAll();
+			}
+		}
+		else if(state == ZOO_EXPIRED_SESSION_STATE)
+		{
+			// can not close the handle inside zookeeper_process, restart it when process() returns
+			LOG_ERROR(("session expired"));
+			zk->connected_ = false;
+			zk->expired_ = true;
+		}
+		else
+		{
+			zk->connected_ = false;
+			LOG_WARN(("not connected, session state: %s", stateStr(state)));
+		}
+		if(zk->sessionCb_)
+		{
+			zk->sessionCb_(zk->connected_);
+		}
+	}
+	else if(type == ZOO_CHANGED_EVENT)
+	{
+		if(zk->dataWatches_.count(path))
+		{
+			zk->armDataWatch(path);
+		}
+	}
+	else if(type == ZOO_CHILD_EVENT)
+	{
+		if(zk->childrenWatches_.count(path))
+		{
+			zk->armChildrenWatch(path);
+		}
+	}
+	else if(type == ZOO_DELETED_EVENT)
+	{
+		// both watches of the node are consumed, read it again: it is dropped if the node is still gone,
+		// or kept if the node is re-created meanwhile
+		LOG_DEBUG(("%s: %s", eventStr(type), path));
+		if(zk->dataWatches_.count(path))
+		{
+			zk->armDataWatch(path);
+		}
+		if(zk->childrenWatches_.count(path))
+		{
+			zk->armChildrenWatch(path);
+		}
+	}
+	else if(type == ZOO_CREATED_EVENT)
+	{
+		LOG_DEBUG(("%s: %s", eventStr(type), path));
+	}
+	else
+	{
+		LOG_WARN(("unhandled zookeeper event: %s", eventStr(type)));
+	}
+}
+
+void ZooKeeperLoop::dataCompletion(int rc, const char *value, int valueLen, const struct Stat *stat, const void *data)
+{
+	Request *req = static_cast<Request*>(const_cast<void*>(data));
+	string sv;
+	if(ZOK == rc)
+	{
+		sv.assign(value, valueLen);
+	}
+	else
+	{
+		LOG_ERROR(("get %s failed, ret=%s", req->path.c_str(), errorStr(rc)));
+	}
+	if(req->dataCb)
+	{
+		req->dataCb(ZkRet(rc), sv);
+	}
+	delete req;
+}
+
+void ZooKeeperLoop::stringsCompletion(int rc, const struct String_vector *strings, const void *data)
+{
+	Request *req = static_cast<Request*>(const_cast<void*>(data));
+	vector<string> vecs;
+	if(ZOK == rc)
+	{
+		for(int i = 0; i < strings->count; ++i)
+		{
+			vecs.push_back(strings->data[i]);
+		}
+	}
+	else
+	{
+		LOG_ERROR(("get children %s failed, ret=%s", req->path.c_str(), errorStr(rc)));
+	}
+	if(req->childrenCb)
+	{
+		req->childrenCb(ZkRet(rc), vecs);
+	}
+	delete req;
+}
+
+void ZooKeeperLoop::statCompletion(int rc, const struct Stat *stat, const void *data)
+{
+	Request *req = static_cast<Request*>(const_cast<void*>(data));
+	if(req->resultCb)
+	{
+		req->resultCb(ZkRet(rc));
+	}
+	delete req;
+}
+
+void ZooKeeperLoop::setCompletion(int rc, const struct Stat *stat, const void *data)
+{
+	Request *req = static_cast<Request*>(const_cast<void*>(data));
+	if(ZNONODE == rc)
+	{
+		// create it, but just a normal node, the same as ZooKeeper::setData
+		req->recursive = true;
+		ZkRet zr = req->zk->createTheNode(req);
+		if(!zr)
+		{
+			req->zk->finishCreate(req, zr.code(), "");
+		}
+		return;
+	}
+	if(ZOK != rc)
+	{
+		LOG_ERROR(("set %s failed, ret=%s", req->path.c_str(), errorStr(rc)));
+	}
+	if(req->resultCb)
+	{
+		req->resultCb(ZkRet(rc));
+	}
+	delete req;
+}
+
+void ZooKeeperLoop::createCompletion(int rc, const char *value, const void *data)
+{
+	Request *req = static_cast<Request*>(const_cast<void*>(data));
+	ZooKeeperLoop *zk = req->zk;
+	if(ZNONODE == rc && req->recursive)
+	{
+		string ppath = parentPath(req->path);
+		if(!ppath.empty())
+		{
+			// parent node must not be ephemeral node or sequence node
+			Request *preq = new Request(zk, ppath);
+			preq->recursive = true;
+			preq->resultCb = boost::bind(&ZooKeeperLoop::onParentCreated, zk, req, _1);
+			ZkRet zr = zk->createTheNode(preq);
+			if(!zr)
+			{
+				delete preq;
+				zk->finishCreate(req, zr.code(), "");
+			}
+			return;
+		}
+	}
+	zk->finishCreate(req, rc, (ZOK == rc && value) ? value : "");
+}
+
+void ZooKeeperLoop::watchDataCompletion(int rc, const char *value, int valueLen, const struct Stat *stat, const void *data)
+{
+	Request *req = static_cast<Request*>(const_cast<void*>(data));
+	DataWatchMap &watches = req->zk->dataWatches_;
+	DataWatchMap::iterator itr = watches.find(req->path);
+	if(watches.end() != itr)
+	{
+		if(ZOK == rc)
+		{
+			// copy it, the callback may replace the watch
+			DataWatchCallback cb = itr->second;
+			cb(req->path, string(value, valueLen));
+		}
+		else if(ZNONODE == rc)
+		{
+			LOG_ERROR(("data watch dropped, node does not exist, path=%s", req->path.c_str()));
+			watches.erase(itr);
+		}
+		else
+		{
+			// ZCONNECTIONLOSS, ZOPERATIONTIMEOUT, ZSESSIONEXPIRED, ZCLOSING
+			LOG_ERROR(("data completion error, ret=%s, path=%s", errorStr(rc), req->path.c_str()));
+		}
+	}
+	delete req;
+}
+
+void ZooKeeperLoop::watchChildrenCompletion(int rc, const struct String_vector *strings, const void *data)
+{
+	Request *req = static_cast<Request*>(const_cast<void*>(data));
+	ChildrenWatchMap &watches = req->zk->childrenWatches_;
+	ChildrenWatchMap::iterator itr = watches.find(req->path);
+	if(watches.end() != itr)
+	{
+		if(ZOK == rc)
+		{
+			vector<string> vecs;
+			for(int i = 0; i < strings->count; ++i)
+			{
+				vecs.push_back(strings->data[i]);
+			}
+			ChildrenWatchCallback cb = itr->second;
+			cb(req->path, vecs);
+		}
+		else if(ZNONODE == rc)
+		{
+			LOG_ERROR(("children watch dropped, node does not exist, path=%s", req->path.c_str()));
+			watches.erase(itr);
+		}
+		else
+		{
+			LOG_ERROR(("strings completion error, ret=%s, path=%s", errorStr(rc), req->path.c_str()));
+		}
+	}
+	delete req;
+}
+
+ZooKeeperLoop::ZooKeeperLoop()
+	: zhandle_ (NULL)
+	, connected_ (false)
+	, expired_ (false)
+	, rearm_ (false)
+	, defaultLogLevel_ (ZOO_LOG_LEVEL_WARN)
+{
+	setDebugLogLevel(false);
+}
+
+ZooKeeperLoop::~ZooKeeperLoop()
+{
+	if(zhandle_)
+	{
+		zookeeper_close(zhandle_);
+		zhandle_ = NULL;
+	}
+}
+
+ZkRet ZooKeeperLoop::init(const std::string &connectString)
+{
+	connectString_ = connectString;
+	zhandle_ = zookeeper_init(connectString.c_str(), sessionWatcher, ZK_RECV_TIMEOUT, NULL, this, 0);
+	if(NULL == zhandle_)
+	{
+		LOG_ERROR(("zookeeper_init failed, connectString=%s", connectString.c_str()));
+		return ZkRet(ZSYSTEMERROR);
+	}
+	return ZkRet(ZOK);
+}
+
+void ZooKeeperLoop::restart()
+{
+	expired_ = false;
+	if(NULL != zhandle_)
+	{
+		zookeeper_close(zhandle_);
+	}
+	zhandle_ = zookeeper_init(connectString_.c_str(), sessionWatcher, ZK_RECV_TIMEOUT, NULL, this, 0);
+	if(NULL == zhandle_)
+	{
+		LOG_ERROR(("restart failed."));
+		return;
+	}
+	rearm_ = true;
+}
+
+ZkRet ZooKeeperLoop::interest(int &fd, int &events, int &timeout)
+{
+	if(NULL == zhandle_)
+	{
+		return ZkRet(ZINVALIDSTATE);
+	}
+	struct timeval tv;
+	int ret = zookeeper_interest(zhandle_, &fd, &events, &tv);
+	timeout = tv.tv_sec * 1000 + tv.tv_usec / 1000;
+	return ZkRet(ret);
+}
+
+ZkRet ZooKeeperLoop::process(int events)
+{
+	if(NULL == zhandle_)
+	{
+		return ZkRet(ZINVALIDSTATE);
+	}
+	int ret = zookeeper_process(zhandle_, events);
+	if(expired_)
+	{
+		restart();
+	}
+	if(ZNOTHING == ret)
+	{
+		ret = ZOK;
+	}
+	return ZkRet(ret);
+}
+
+ZkRet ZooKeeperLoop::getData(const std::string &path, const DataCallback &cb)
+{
+	Request *req = new Request(this, path);
+	req->dataCb = cb;
+	int ret = zoo_aget(zhandle_, path.c_str(), false, &ZooKeeperLoop::dataCompletion, req);
+	if(ZOK != ret)
+	{
+		LOG_ERROR(("aget failed, path=%s, ret=%s", path.c_str(), errorStr(ret)));
+		delete req;
+	}
+	return ZkRet(ret);
+}
+
+ZkRet ZooKeeperLoop::setData(const std::string &path, const std::string &value, const ResultCallback &cb)
+{
+	Request *req = new Request(this, path);
+	req->value = value;
+	req->resultCb = cb;
+	int ret = zoo_aset(zhandle_, path.c_str(), value.c_str(), value.length(), -1, &ZooKeeperLoop::setCompletion, req);
+	if(ZOK != ret)
+	{
+		LOG_ERROR(("aset failed, path=%s, ret=%s", path.c_str(), errorStr(ret)));
+		delete req;
+	}
+	return ZkRet(ret);
+}
+
+ZkRet ZooKeeperLoop::getChildren(const std::string &path, const ChildrenCallback &cb)
+{
+	Request *req = new Request(this, path);
+	req->childrenCb = cb;
+	int ret = zoo_aget_children(zhandle_, path.c_str(), false, &ZooKeeperLoop::stringsCompletion, req);
+	if(ZOK != ret)
+	{
+		LOG_ERROR(("aget_children failed, path=%s, ret=%s", path.c_str(), errorStr(ret)));
+		delete req;
+	}
+	return ZkRet(ret);
+}
+
+ZkRet ZooKeeperLoop::exists(const std::string &path, const ResultCallback &cb)
+{
+	Request *req = new Request(this, path);
+	req->resultCb = cb;
+	int ret = zoo_aexists(zhandle_, path.c_str(), false, &ZooKeeperLoop::statCompletion, req);
+	if(ZOK != ret)
+	{
+		delete req;
+	}
+	return ZkRet(ret);
+}
+
+ZkRet ZooKeeperLoop::createNode(const std::string &path, const std::string &value, const ResultCallback &cb, bool recursive/*=true*/)
+{
+	Request *req = new Request(this, path);
+	req->value = value;
+	req->recursive = recursive;
+	req->resultCb = cb;
+	ZkRet zr = createTheNode(req);
+	if(!zr)
+	{
+		delete req;
+	}
+	return zr;
+}
+
+ZkRet ZooKeeperLoop::createEphemeralNode(const std::string &path, const std::string &value, const ResultCallback &cb, bool recursive/*=true*/)
+{
+	Request *req = new Request(this, path);
+	req->value = value;
+	req->flag = ZOO_EPHEMERAL;
+	req->recursive = recursive;
+	req->resultCb = cb;
+	ZkRet zr = createTheNode(req);
+	if(!zr)
+	{
+		delete req;
+	}
+	return zr;
+}
+
+ZkRet ZooKeeperLoop::createSequenceNode(const std::string &path, const std::string &value, const CreateCallback &cb, bool recursive/*=true*/)
+{
+	Request *req = new Request(this, path);
+	req->value = value;
+	req->flag = ZOO_SEQUENCE;
+	req->recursive = recursive;
+	req->createCb = cb;
+	ZkRet zr = createTheNode(req);
+	if(!zr)
+	{
+		delete req;
+	}
+	return zr;
+}
+
+ZkRet ZooKeeperLoop::createSequenceEphemeralNode(const std::string &path, const std::string &value, const CreateCallback &cb, bool recursive/*=true*/)
+{
+	Request *req = new Request(this, path);
+	req->value = value;
+	req->flag = ZOO_SEQUENCE|ZOO_EPHEMERAL;
+	req->recursive = recursive;
+	req->createCb = cb;
+	ZkRet zr = createTheNode(req);
+	if(!zr)
+	{
+		delete req;
+	}
+	return zr;
+}
+
+ZkRet ZooKeeperLoop::createTheNode(Request *req)
+{
+	int ret = zoo_acreate(zhandle_, req->path.c_str(), req->value.c_str(), req->value.length(), &ZOO_OPEN_ACL_UNSAFE, req->flag, &ZooKeeperLoop::createCompletion, req);
+	if(ZOK != ret)
+	{
+		LOG_ERROR(("acreate failed, path=%s, ret=%s", req->path.c_str(), errorStr(ret)));
+	}
+	return ZkRet(ret);
+}
+
+void ZooKeeperLoop::onParentCreated(Request *req, const ZkRet &ret)
+{
+	if(ret.ok() || ret.nodeExist())
+	{
+		// parent node is ready, create this node again, but only once
+		req->recursive = false;
+		ZkRet zr = createTheNode(req);
+		if(!zr)
+		{
+			finishCreate(req, zr.code(), "");
+		}
+	}
+	else
+	{
+		finishCreate(req, ret.code(), "");
+	}
+}
+
+void ZooKeeperLoop::finishCreate(Request *req, int rc, const std::string &rpath)
+{
+	if(ZOK != rc && ZNODEEXISTS != rc)
+	{
+		LOG_ERROR(("create node failed, path=%s, ret=%s", req->path.c_str(), errorStr(rc)));
+	}
+	if(req->createCb)
+	{
+		req->createCb(ZkRet(rc), rpath);
+	}
+	else if(req->resultCb)
+	{
+		req->resultCb(ZkRet(rc));
+	}
+	delete req;
+}
+
+ZkRet ZooKeeperLoop::watchData(const std::string &path, const DataWatchCallback &wc)
+{
+	dataWatches_[path] = wc;
+	ZkRet zr = armDataWatch(path);
+	if(!zr)
+	{
+		dataWatches_.erase(path);
+	}
+	return zr;
+}
+
+ZkRet ZooKeeperLoop::watchChildren(const std::string &path, const ChildrenWatchCallback &wc)
+{
+	childrenWatches_[path] = wc;
+	ZkRet zr = armChildrenWatch(path);
+	if(!zr)
+	{
+		childrenWatches_.erase(path);
+	}
+	return zr;
+}
+
+ZkRet ZooKeeperLoop::armDataWatch(const std::string &path)
+{
+	Request *req = new Request(this, path);
+	int ret = zoo_awget(zhandle_, path.c_str(), &ZooKeeperLoop::sessionWatcher, this, &ZooKeeperLoop::watchDataCompletion, req);
+	if(ZOK != ret)
+	{
+		LOG_ERROR(("awget failed, path=%s, ret=%s", path.c_str(), errorStr(ret)));
+		delete req;
+	}
+	return ZkRet(ret);
+}
+
+ZkRet ZooKeeperLoop::armChildrenWatch(const std::string &path)
+{
+	Request *req = new Request(this, path);
+	int ret = zoo_awget_children(zhandle_, path.c_str(), &ZooKeeperLoop::sessionWatcher, this, &ZooKeeperLoop::watchChildrenCompletion, req);
+	if(ZOK != ret)
+	{
+		LOG_ERROR(("awget_children failed, path=%s, ret=%s", path.c_str(), errorStr(ret)));
+		delete req;
+	}
+	return ZkRet(ret);
+}
+
+void ZooKeeperLoop::armAll()
+{
+	for(DataWatchMap::const_iterator it = dataWatches_.begin(); it != dataWatches_.end(); ++it)
+	{
+		armDataWatch(it->first);
+	}
+	for(ChildrenWatchMap::const_iterator it = childrenWatches_.begin(); it != childrenWatches_.end(); ++it)
+	{
+		armChildrenWatch(it->first);
+	}
+}
+
+void ZooKeeperLoop::setDebugLogLevel(bool open)
+{
+	ZooLogLevel loglevel = defaultLogLevel_;
+	if(open)
+	{
+		loglevel = ZOO_LOG_LEVEL_DEBUG;
+	}
+	zoo_set_debug_level(loglevel);
+}
@@ -0,0 +1,97 @@
+#ifndef _ZOOKEEPER_LOOP_H_
+#define _ZOOKEEPER_LOOP_H_
+
+#include "ZooKeeper.h"
+
+// class ZooKeeperLoop, single-threaded zookeeper client driven by the application's own event loop.
+// it is built into libcppzk_st.a and linked with zookeeper_st, no extra thread is created.
+// the session only makes progress inside process(), and every callback is called from process(), 
+// so callbacks run on the loop thread and need no lock.
+// usage, in every loop iteration:
+//     int fd, events, timeout;
+//     zk.interest(fd, events, timeout); // fd may change after reconnecting, register it again every time
+//     ... wait at most timeout ms for events(ZOOKEEPER_READ|ZOOKEEPER_WRITE) on fd ...
+//     zk.process(readyEvents); // readyEvents is 0 when timed out
+// thread safety: ZooKeeperLoop object must only be used in the loop thread.
+class ZooKeeperLoop : public boost::noncopyable
+{
+public:
+	typedef boost::function<void (bool connected)> SessionCallback;
+	typedef boost::function<void (const ZkRet &ret)> ResultCallback;
+	typedef boost::function<void (const ZkRet &ret, const std::string &value)> DataCallback;
+	typedef boost::function<void (const ZkRet &ret, const std::vector<std::string> &children)> ChildrenCallback;
+	typedef boost::function<void (const ZkRet &ret, const std::string &rpath)> CreateCallback;
+	//
+	ZooKeeperLoop();
+	// pending callbacks are called with ZCLOSING
+	~ZooKeeperLoop();
+	// non-blocking, the session gets connected later in process()
+	ZkRet init(const std::string &connectString);
+	void setSessionCallback(const SessionCallback &cb){sessionCb_ = cb; }
+	bool connected() const {return connected_; }
+	// event loop integration
+	ZkRet interest(int &fd, int &events, int &timeout);
+	ZkRet process(int events);
+	// asynchronous operations, the returned ZkRet only tells whether the request is sent, 
+	// the result is passed to the callback
+	ZkRet getData(const std::string &path, const DataCallback &cb);
+	ZkRet setData(const std::string &path, const std::string &value, const ResultCallback &cb);
+	ZkRet getChildren(const std::string &path, const ChildrenCallback &cb);
+	ZkRet exists(const std::string &path, const ResultCallback &cb);
+	ZkRet createNode(const std::string &path, const std::string &value, const ResultCallback &cb, bool recursive = true);
+	ZkRet createEphemeralNode(const std::string &path, const std::string &value, const ResultCallback &cb, bool recursive = true);
+	ZkRet createSequenceNode(const std::string &path, const std::string &value, const CreateCallback &cb, bool recursive = true);
+	ZkRet createSequenceEphemeralNode(const std::string &path, const std::string &value, const CreateCallback &cb, bool recursive = true);
+	// the watch is dropped if the node does not exist
+	ZkRet watchData(const std::string &path, const DataWatchCallback &wc);
+	ZkRet watchChildren(const std::string &path, const ChildrenWatchCallback &wc);
+	//
+	void setDebugLogLevel(bool open = true);
+private:
+	// context of a single asynchronous request, deleted when it's completed
+	struct Request
+	{
+		Request(ZooKeeperLoop *z, const std::string &p) : zk (z), path (p), flag (0), recursive (false) {}
+		ZooKeeperLoop *zk;
+		std::string path;
+		std::string value;
+		int flag;
+		bool recursive;
+		ResultCallback resultCb;
+		DataCallback dataCb;
+		ChildrenCallback childrenCb;
+		CreateCallback createCb;
+	};
+	//
+	static void sessionWatcher(zhandle_t *zh, int type, int state, const char *path, void *watcherCtx);
+	static void dataCompletion(int rc, const char *value, int valueLen, const struct Stat *stat, const void *data);
+	static void stringsCompletion(int rc, const struct String_vector *strings, const void *data);
+	static void statCompletion(int rc, const struct Stat *stat, const void *data);
+	static void setCompletion(int rc, const struct Stat *stat, const void *data);
+	static void createCompletion(int rc, const char *value, const void *data);
+	static void watchDataCompletion(int rc, const char *value, int valueLen, const struct Stat *stat, const void *data);
+	static void watchChildrenCompletion(int rc, const struct String_vector *strings, const void *data);
+	//
+	ZkRet createTheNode(Request *req);
+	void onParentCreated(Request *req, const ZkRet &ret);
+	void finishCreate(Request *req, int rc, const std::string &rpath);
+	ZkRet armDataWatch(const std::string &path);
+	ZkRet armChildrenWatch(const std::string &path);
+	void armAll();
+	void restart();
+	//
+	typedef std::map<std::string, DataWatchCallback> DataWatchMap;
+	typedef std::map<std::string, ChildrenWatchCallback> ChildrenWatchMap;
+	//
+	zhandle_t *zhandle_;
+	std::string connectString_;
+	bool connected_;
+	bool expired_;
+	bool rearm_;
+	ZooLogLevel defaultLogLevel_;
+	SessionCallback sessionCb_;
+	DataWatchMap dataWatches_;
+	ChildrenWatchMap childrenWatches_;
+};
+
+#endif
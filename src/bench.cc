@@ -0,0 +1,215 @@
+// benchmarks of the recipes
+//     bench shard [members] [partitions] [virtualNodes]  consistent hash assignment, no server needed
+//     bench barrier hosts [workers] [sessions] [phases]  phase transition latency of ZkDoubleBarrier
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <pthread.h>
+#include "ZkShardGroup.h"
+#include "ZkDoubleBarrier.h"
+#include "ZkUtil.h"
+
+using namespace std;
+
+static string memberName(size_t i)
+{
+	ostringstream os;
+	os << "worker-host-" << i << ":8080";
+	return os.str();
+}
+
+static size_t countMoved(const vector<string> &m1, const vector<int> &o1, const vector<string> &m2, const vector<int> &o2)
+{
+	size_t moved = 0;
+	for(size_t p = 0; p < o1.size(); ++p)
+	{
+		if(m1[o1[p]] != m2[o2[p]])
+		{
+			++moved;
+		}
+	}
+	return moved;
+}
+
+static void benchShard(size_t members, size_t partitions, int virtualNodes)
+{
+	vector<string> group;
+	for(size_t i = 0; i < members; ++i)
+	{
+		group.push_back(memberName(i));
+	}
+	std::sort(group.begin(), group.end());
+	// recompute time, what a member pays for each view change
+	vector<int> owners;
+	const int rounds = 10;
+	long long start = nowMicros();
+	for(int i = 0; i < rounds; ++i)
+	{
+		ZkShardGroup::computeOwners(group, partitions, virtualNodes, owners);
+	}
+	double ms = (nowMicros() - start) / 1000.0 / rounds;
+	// balance
+	vector<size_t> load(members, 0);
+	for(size_t p = 0; p < partitions; ++p)
+	{
+		++load[owners[p]];
+	}
+	size_t maxLoad = *std::max_element(load.begin(), load.end());
+	size_t minLoad = *std::min_element(load.begin(), load.end());
+	// one member joins
+	vector<string> joined(group);
+	joined.push_back(memberName(members));
+	std::sort(joined.begin(), joined.end());
+	vector<int> joinedOwners;
+	ZkShardGroup::computeOwners(joined, partitions, virtualNodes, joinedOwners);
+	size_t joinMoved = countMoved(group, owners, joined, joinedOwners);
+	// one member leaves
+	vector<string> left(group.begin() + 1, group.end());
+	vector<int> leftOwners;
+	ZkShardGroup::computeOwners(left, partitions, virtualNodes, leftOwners);
+	size_t leaveMoved = countMoved(group, owners, left, leftOwners);
+	// the same with partition % members
+	size_t moduloMoved = 0;
+	for(size_t p = 0; p < partitions; ++p)
+	{
+		if(p % members != p % (members + 1))
+		{
+			++moduloMoved;
+		}
+	}
+	cout << "members=" << members << ", partitions=" << partitions << ", virtualNodes=" << virtualNodes << endl;
+	cout << "recompute: " << ms << " ms" << endl;
+	cout << "partitions per member: avg=" << (double)partitions / members << ", min=" << minLoad << ", max=" << maxLoad << endl;
+	cout << "moved on join: " << joinMoved << " (" << 100.0 * joinMoved / partitions << "%), ideal " << 100.0 / (members + 1) << "%" << endl;
+	cout << "moved on leave: " << leaveMoved << " (" << 100.0 * leaveMoved / partitions << "%), ideal " << 100.0 / members << "%" << endl;
+	cout << "moved on join by modulo: " << moduloMoved << " (" << 100.0 * moduloMoved / partitions << "%)" << endl;
+}
+
+struct BarrierWorker
+{
+	std::vector<ZkDoubleBarrier*> phases; // barriers of its session
+	std::vector<long long> enterCall, entered, leaveCall, left;
+};
+
+static void *barrierWorker(void *arg)
+{
+	BarrierWorker *w = static_cast<BarrierWorker*>(arg);
+	for(size_t p = 0; p < w->phases.size(); ++p)
+	{
+		w->enterCall[p] = nowMicros();
+		if(!w->phases[p]->enter(60000))
+		{
+			cout << "enter failed, phase=" << p << endl;
+		}
+		w->entered[p] = nowMicros();
+		w->leaveCall[p] = nowMicros();
+		if(!w->phases[p]->leave(60000))
+		{
+			cout << "leave failed, phase=" << p << endl;
+		}
+		w->left[p] = nowMicros();
+	}
+	return NULL;
+}
+
+// from the last party arriving to the last party released
+static double transitionMs(const std::vector<BarrierWorker> &workers, size_t p, bool enter)
+{
+	long long lastCall = 0;
+	long long lastDone = 0;
+	for(size_t i = 0; i < workers.size(); ++i)
+	{
+		lastCall = max(lastCall, enter ? workers[i].enterCall[p] : workers[i].leaveCall[p]);
+		lastDone = max(lastDone, enter ? workers[i].entered[p] : workers[i].left[p]);
+	}
+	return (lastDone - lastCall) / 1000.0;
+}
+
+static void benchBarrier(const std::string &hosts, size_t workers, size_t sessions, size_t phases)
+{
+	sessions = min(sessions, workers);
+	std::vector<boost::shared_ptr<ZooKeeper> > zks;
+	for(size_t i = 0; i < sessions; ++i)
+	{
+		zks.push_back(boost::shared_ptr<ZooKeeper>(new ZooKeeper()));
+		if(!zks.back()->init(hosts))
+		{
+			cout << "init zk failed." << endl;
+			return;
+		}
+	}
+	// one barrier per session and phase, shared by the workers of the session
+	ostringstream root;
+	root << "/cppzk_bench/barrier-" << nowMicros();
+	std::vector<boost::shared_ptr<ZkDoubleBarrier> > barriers;
+	std::vector<BarrierWorker> bw(workers);
+	for(size_t s = 0; s < sessions; ++s)
+	{
+		for(size_t p = 0; p < phases; ++p)
+		{
+			ostringstream path;
+			path << root.str() << "/phase-" << p;
+			barriers.push_back(boost::shared_ptr<ZkDoubleBarrier>(new ZkDoubleBarrier(*zks[s], path.str(), workers)));
+		}
+	}
+	for(size_t i = 0; i < workers; ++i)
+	{
+		for(size_t p = 0; p < phases; ++p)
+		{
+			bw[i].phases.push_back(barriers[(i % sessions) * phases + p].get());
+		}
+		bw[i].enterCall.resize(phases);
+		bw[i].entered.resize(phases);
+		bw[i].leaveCall.resize(phases);
+		bw[i].left.resize(phases);
+	}
+	std::vector<pthread_t> threads(workers);
+	for(size_t i = 0; i < workers; ++i)
+	{
+		pthread_create(&threads[i], NULL, &barrierWorker, &bw[i]);
+	}
+	for(size_t i = 0; i < workers; ++i)
+	{
+		pthread_join(threads[i], NULL);
+	}
+	double enterMs = 0;
+	double leaveMs = 0;
+	for(size_t p = 0; p < phases; ++p)
+	{
+		enterMs += transitionMs(bw, p, true);
+		leaveMs += transitionMs(bw, p, false);
+	}
+	cout << "workers=" << workers << ", sessions=" << sessions << ", phases=" << phases 
+		<< ", enter=" << enterMs / phases << " ms, leave=" << leaveMs / phases << " ms" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+	if(argc >= 2 && 0 == strcmp(argv[1], "shard"))
+	{
+		size_t members = argc > 2 ? atoi(argv[2]) : 1000;
+		size_t partitions = argc > 3 ? atoi(argv[3]) : 10000;
+		int virtualNodes = argc > 4 ? atoi(argv[4]) : 100;
+		benchShard(members, partitions, virtualNodes);
+		return 0;
+	}
+	if(argc >= 3 && 0 == strcmp(argv[1], "barrier"))
+	{
+		// latency versus worker count, up to the given number
+		size_t maxWorkers = argc > 3 ? atoi(argv[3]) : 2000;
+		size_t sessions = argc > 4 ? atoi(argv[4]) : 16;
+		size_t phases = argc > 5 ? atoi(argv[5]) : 5;
+		for(size_t workers = 10; workers < maxWorkers; workers *= 10)
+		{
+			benchBarrier(argv[2], workers, sessions, phases);
+		}
+		benchBarrier(argv[2], maxWorkers, sessions, phases);
+		return 0;
+	}
+	cout << "usage: " << argv[0] << " shard [members] [partitions] [virtualNodes]" << endl;
+	cout << "       " << argv[0] << " barrier hosts [workers] [sessions] [phases]" << endl;
+	return -1;
+}
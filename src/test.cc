@@ -2,14 +2,26 @@
 #include <string>
 #include <assert.h>
 #include <vector>
+#include <algorithm>
 #include <boost/bind.hpp>
 #include "ZooKeeper.h"
+#include "ZkConfig.h"
+#include "ZkShardGroup.h"
+#include "ZkDoubleBarrier.h"
+#include "ZkServerSelector.h"
+#include "ZkUtil.h"
 
 using namespace std;
 
 void testSet(const char *path, const char *data);
 void testCreate(const char *path, const char *data, char type, bool recursive);
 void testStaticFunctions(const std::string &path);
+void testSessionManager();
+void valueCallback(const std::string &path, const std::string &value, std::string *last);
+void reregisterCallback(const std::string &oldPath, const std::string &newPath, const ZkRet &ret);
+void expireSession(const clientid_t &cid);
+bool parseNumber(const std::string &value, long &number);
+void assignmentCallback(const std::string &member, const std::vector<size_t> &acquired, const std::vector<size_t> &released);
 
 // define data callback
 void dataCallback(const std::string &path, const std::string &value)
@@ -30,8 +42,16 @@ void childrenCallback(const std::string &path, const vector<string> &children)
 	cout << endl;
 }
 
+// keep the last value
+void valueCallback(const std::string &path, const std::string &value, std::string *last)
+{
+	*last = value;
+}
+
 // define ZooKeeper object
 ZooKeeper zk; 
+// ephemeral nodes under /testre re-created
+int reregistered = 0;
 
 
 int main()
@@ -77,6 +97,167 @@ int main()
 		cout << "watch children failed, path=/testc" << endl;
 	}
 
+	// test for watch fan-out, one server side watch, two subscribers both get the update, and unwatch one of them
+	ZooKeeper::WatchId wid1, wid2;
+	string fovalue1, fovalue2;
+	assert(zk.setData("/testfo", "testfo-1"));
+	assert(zk.watchData("/testfo", boost::bind(&valueCallback, _1, _2, &fovalue1), &wid1));
+	assert(zk.watchData("/testfo", boost::bind(&valueCallback, _1, _2, &fovalue2), &wid2));
+	sleep(1);
+	assert(fovalue1 == "testfo-1" && fovalue2 == "testfo-1");
+	assert(zk.setData("/testfo", "testfo-2"));
+	sleep(1);
+	assert(fovalue1 == "testfo-2" && fovalue2 == "testfo-2");
+	assert(zk.unwatchData("/testfo", wid1));
+	assert(!zk.unwatchData("/testfo", wid1));
+	assert(zk.setData("/testfo", "testfo-3"));
+	sleep(1);
+	assert(fovalue1 == "testfo-2" && fovalue2 == "testfo-3");
+	assert(zk.unwatchData("/testfo", wid2));
+
+	// test for watch across deletion, the subscriber sees the re-created node
+	string wdvalue;
+	assert(zk.setData("/testwd", "testwd-1"));
+	assert(zk.watchData("/testwd", boost::bind(&valueCallback, _1, _2, &wdvalue)));
+	assert(zk.deleteNode("/testwd"));
+	assert(zk.createNode("/testwd", "testwd-2"));
+	sleep(1);
+	assert(wdvalue == "testwd-2");
+
+	// test for coalesced watches, at most one read per 100ms, and children read 50ms after a change
+	ZooKeeper::WatchStats wstats;
+	string covalue;
+	assert(zk.setData("/testco", "testco-data"));
+	assert(zk.watchData("/testco", boost::bind(&valueCallback, _1, _2, &covalue), NULL, ZooKeeper::WatchOptions(100)));
+	// the watch is set by the first read
+	sleep(1);
+	assert(covalue == "testco-data");
+	for(int i = 0; i < 100; ++i)
+	{
+		ostringstream os;
+		os << "testco-" << i;
+		assert(zk.setData("/testco", os.str()));
+	}
+	sleep(1);
+	assert(zk.dataWatchStats("/testco", wstats));
+	cout << "coalesced watch: events=" << wstats.events << ", reads=" << wstats.reads << ", folded=" << wstats.folded << endl;
+	assert(wstats.events > 0 && (wstats.reads < wstats.events || wstats.folded > 0));
+	// the last value is read after the interval
+	assert(covalue == "testco-99");
+	zk.watchChildren("/testc", boost::bind(&childrenCallback, _1, _2), NULL, ZooKeeper::WatchOptions(0, 50));
+
+	// test for queued writes
+	zk.enableOfflineQueue(1000, ZooKeeper::DROP_OLDEST);
+	ZkFuture f1 = zk.setDataQueued("/testq/testq", "testq-1");
+	ZkFuture f2 = zk.setDataQueued("/testq/testq", "testq-2");
+	ZkFuture f3 = zk.createNodeQueued("/testq/testqn", "testqn-data");
+	assert(f1.get() && f2.get());
+	assert(f3.get() || f3.get().nodeExist());
+	string qvalue;
+	assert(zk.getData("/testq/testq", qvalue) && qvalue == "testq-2");
+
+	// test for the offline queue, writes parked before connected, the oldest dropped when full, replayed in order
+	{
+		zk.deleteNode("/testoq/node");
+		zk.deleteNode("/testoq/drop");
+		ZooKeeper zkq;
+		zkq.enableOfflineQueue(3, ZooKeeper::DROP_OLDEST);
+		ZkFuture d1 = zkq.setDataQueued("/testoq/drop", "testoq-drop");
+		ZkFuture d2 = zkq.createNodeQueued("/testoq/node", "testoq-1");
+		ZkFuture d3 = zkq.deleteNodeQueued("/testoq/node");
+		ZkFuture d4 = zkq.createNodeQueued("/testoq/node", "testoq-2");
+		assert(zkq.offlineQueueSize() == 3);
+		assert(d1.ready() && !d1.get());
+		assert(!d2.ready() && !d3.ready() && !d4.ready());
+		assert(zkq.init("127.0.0.1:2181,127.0.0.1:2182,127.0.0.1:2183"));
+		assert(d2.get() && d3.get() && d4.get());
+		assert(zkq.offlineQueueSize() == 0);
+		assert(zk.getData("/testoq/node", qvalue) && qvalue == "testoq-2");
+		assert(zk.exists("/testoq/drop").nodeNotExist());
+	}
+
+	// test for typed config, parsed once per value
+	assert(zk.setData("/testcfg", "100"));
+	ZkConfig<long> cfg(&parseNumber);
+	ZkConfig<long>::Reader cfgReader(cfg);
+	assert(cfg.init(zk, "/testcfg"));
+	assert(*cfgReader.get() == 100);
+	assert(zk.setData("/testcfg", "200"));
+	sleep(1);
+	assert(*cfgReader.get() == 200 && cfg.version() == 2);
+	// a malformed first value is not published
+	assert(zk.setData("/testcfgbad", "testcfgbad"));
+	ZkConfig<long> badCfg(&parseNumber);
+	assert(!badCfg.init(zk, "/testcfgbad") && !badCfg.get());
+
+	// test for shard group, the second member takes about half of the partitions, handed over by the first
+	{
+		ZooKeeper zk2;
+		assert(zk2.init("127.0.0.1:2181,127.0.0.1:2182,127.0.0.1:2183"));
+		ZkShardGroup group1(zk, "/testshard", "member1", 100);
+		ZkShardGroup group2(zk2, "/testshard", "member2", 100);
+		assert(group1.join(boost::bind(&assignmentCallback, "member1", _1, _2)));
+		sleep(1);
+		assert(group1.ownedPartitions().size() == 100);
+		assert(group2.join(boost::bind(&assignmentCallback, "member2", _1, _2)));
+		sleep(1);
+		assert(group1.ownedPartitions().size() + group2.ownedPartitions().size() == 100);
+		assert(group2.leave());
+		sleep(1);
+		assert(group1.ownedPartitions().size() == 100);
+	}
+
+	// test for double barrier, two parties over two sessions, one times out alone first
+	{
+		ZooKeeper zk2;
+		assert(zk2.init("127.0.0.1:2181,127.0.0.1:2182,127.0.0.1:2183"));
+		// a new path for each run
+		ostringstream phase;
+		phase << "/testbarrier/phase-" << nowMicros();
+		ZkDoubleBarrier barrier1(zk, phase.str(), 2);
+		ZkDoubleBarrier barrier2(zk2, phase.str(), 2);
+		assert(!barrier1.enter(100));
+		assert(barrier2.enter(1000));
+		assert(!barrier1.leave(100));
+		assert(barrier2.leave(1000));
+	}
+
+	// test for ephemeral re-registration, the nodes come back after session expiry
+	zk.setReregisterCallback(boost::bind(&reregisterCallback, _1, _2, _3));
+	assert(zk.createEphemeralNode("/testre/testre", "testre-data"));
+	assert(zk.createEphemeralNode("/testre/testred", "testred-data"));
+	assert(zk.deleteNode("/testre/testred"));
+	assert(zk.exists("/testre/testred").nodeNotExist());
+	assert(zk.lastReregisterMicros() == -1);
+	expireSession(zk.clientId());
+	sleep(5);
+	assert(zk.lastReregisterMicros() >= 0 && reregistered == 1);
+	assert(zk.exists("/testre/testre") && zk.exists("/testre/testred").nodeNotExist());
+
+	// test for server selection, an unreachable server is never preferred, skew 0 keeps just minServers
+	{
+		ZkServerSelector selector("127.0.0.1:2181,127.0.0.1:2182,127.0.0.1:2183,127.0.0.1:1", 1000.0, 1);
+		assert(selector.probe() == 3);
+		assert(selector.serverRtts()["127.0.0.1:1"] == -1);
+		string preferred = selector.preferredConnectString();
+		assert(string::npos == preferred.find("127.0.0.1:1") && std::count(preferred.begin(), preferred.end(), ',') == 2);
+		ZkServerSelector tight("127.0.0.1:2181,127.0.0.1:2182,127.0.0.1:2183,127.0.0.1:1", 0.0, 2);
+		preferred = tight.preferredConnectString();
+		assert(string::npos == preferred.find("127.0.0.1:1") && std::count(preferred.begin(), preferred.end(), ',') == 1);
+		assert(!selector.currentServer(zk).empty());
+		assert(selector.rebalance(zk));
+	}
+
+	// test for subtree export and import
+	assert(zk.exportTree("/createnr", "./createnr.bin"));
+	assert(zk.importTree("./createnr.bin", "/importnr"));
+	assert(zk.exists("/importnr/createnr/createnr"));
+	assert(!zk.exportTree("/testnonexist", "./testnonexist.bin"));
+	assert(!zk.importTree("./testnonexist.bin", "/importnonexist"));
+
+	// test for shared sessions
+	testSessionManager();
+
 	// test static functions
 	std::string path1("/");
 	std::string path2("/flour1");
@@ -141,4 +322,69 @@ void testStaticFunctions(const std::string &path)
 	cout << "node name of " << path << " is " << zk.getNodeName(path) << endl;
 	cout << "parent path of " << path << " is " << zk.getParentPath(path) << endl;
 	cout << "parent node name of " << path << " is " << zk.getParentNodeName(path) << endl;
-}
\ No newline at end of file
+}
+
+bool parseNumber(const std::string &value, long &number)
+{
+	std::istringstream is(value);
+	return !!(is >> number);
+}
+
+void assignmentCallback(const std::string &member, const std::vector<size_t> &acquired, const std::vector<size_t> &released)
+{
+	cout << "assignment changed: member=" << member << ", acquired=" << acquired.size() << ", released=" << released.size() << endl;
+}
+
+void reregisterCallback(const std::string &oldPath, const std::string &newPath, const ZkRet &ret)
+{
+	// other ephemeral nodes of the test come back too, only the nodes under /testre are counted
+	if(ret && 0 == oldPath.find("/testre/"))
+	{
+		++reregistered;
+	}
+	cout << "ephemeral node re-created: " << oldPath << " -> " << newPath << ", ok=" << ret.ok() 
+		<< ", micros=" << zk.lastReregisterMicros() << endl;
+}
+
+void sessionWatcher(zhandle_t *zh, int type, int state, const char *path, void *watcherCtx)
+{
+
+}
+
+// take the session over by another handle, then close it, the session expires for the first one
+void expireSession(const clientid_t &cid)
+{
+	zhandle_t *zh = zookeeper_init("127.0.0.1:2181,127.0.0.1:2182,127.0.0.1:2183", sessionWatcher, 10000, &cid, NULL, 0);
+	assert(zh);
+	for(int i = 0; i < 200 && ZOO_CONNECTED_STATE != zoo_state(zh); ++i)
+	{
+		usleep(10000);
+	}
+	assert(ZOO_CONNECTED_STATE == zoo_state(zh));
+	zookeeper_close(zh);
+}
+
+void testSessionManager()
+{
+	cout << "testSessionManager()" << endl;
+	const char *hosts = "127.0.0.1:2181,127.0.0.1:2182,127.0.0.1:2183";
+	ZkSessionManager &mgr = ZkSessionManager::instance();
+	size_t count = mgr.sessionCount();
+	{
+		ZkSessionManager::HandlePtr h1 = mgr.acquire(hosts);
+		ZkSessionManager::HandlePtr h2 = mgr.acquire(hosts);
+		assert(h1 && h2 && &h1->zk() == &h2->zk());
+		assert(mgr.sessionCount() == count + 1);
+		ZooKeeper::WatchId id1, id2;
+		string value1, value2;
+		assert(h1->watchData("/testn", boost::bind(&valueCallback, _1, _2, &value1), &id1));
+		assert(h2->watchData("/testn", boost::bind(&valueCallback, _1, _2, &value2), &id2));
+		assert(id1 != id2);
+		assert(h1->unwatchData("/testn", id1));
+		// the subscription of h2 is unwatched with h2
+		h2.reset();
+		assert(!h1->zk().unwatchData("/testn", id2));
+	}
+	// closed with the last handle
+	assert(mgr.sessionCount() == count);
+}
@@ -0,0 +1,104 @@
+#include <iostream>
+#include <string>
+#include <assert.h>
+#include <vector>
+#include <poll.h>
+#include <boost/bind.hpp>
+#include "ZooKeeperLoop.h"
+
+using namespace std;
+
+// single-threaded test, all callbacks are called from zk.process() in main()
+
+void sessionCallback(bool connected)
+{
+	cout << "session " << (connected ? "connected" : "disconnected") << endl;
+}
+
+void dataCallback(const std::string &path, const std::string &value)
+{
+	cout << "data changed: " << " path=" << path << ", data=" << value << endl;
+}
+
+void childrenCallback(const std::string &path, const vector<string> &children)
+{
+	cout << "children changed: " << ", path=" << path << ", children=" << children.size() << endl;
+}
+
+void createCallback(const std::string &path, const ZkRet &ret)
+{
+	assert(ret || ret.nodeExist());
+	cout << "created: " << path << endl;
+}
+
+void getCallback(const std::string &path, const std::string &expected, const ZkRet &ret, const std::string &value)
+{
+	assert(ret);
+	assert(expected == value);
+	cout << "get: " << path << "=" << value << endl;
+}
+
+void setCallback(ZooKeeperLoop *zk, const std::string &path, const std::string &data, const ZkRet &ret)
+{
+	assert(ret);
+	zk->getData(path, boost::bind(&getCallback, path, data, _1, _2));
+}
+
+// drive the session for at most ms milliseconds
+void runFor(ZooKeeperLoop &zk, int ms)
+{
+	for(int elapsed = 0; elapsed < ms; )
+	{
+		int fd, events, timeout;
+		zk.interest(fd, events, timeout);
+		if(timeout > ms - elapsed)
+			timeout = ms - elapsed;
+		struct pollfd pfd = {fd, 0, 0};
+		if(events & ZOOKEEPER_READ)
+			pfd.events |= POLLIN;
+		if(events & ZOOKEEPER_WRITE)
+			pfd.events |= POLLOUT;
+		int ready = 0;
+		if(poll(&pfd, fd < 0 ? 0 : 1, timeout) > 0)
+		{
+			if(pfd.revents & (POLLIN|POLLHUP|POLLERR))
+				ready |= ZOOKEEPER_READ;
+			if(pfd.revents & POLLOUT)
+				ready |= ZOOKEEPER_WRITE;
+		}
+		zk.process(ready);
+		elapsed += timeout > 0 ? timeout : 1;
+	}
+}
+
+int main()
+{
+	ZooKeeperLoop zk;
+	zk.setSessionCallback(boost::bind(&sessionCallback, _1));
+	if(!zk.init("127.0.0.1:2181,127.0.0.1:2182,127.0.0.1:2183"))
+	{
+		cout << "init zk failed." << endl;
+		return -1;
+	}
+	runFor(zk, 2000);
+	if(!zk.connected())
+	{
+		cout << "connect zk failed." << endl;
+		return -1;
+	}
+
+	cout << "***********start test***********" << endl;
+	zk.setData("/testst", "testst-data", boost::bind(&setCallback, &zk, "/testst", "testst-data", _1));
+	zk.createNode("/createst/createst/createst", "createst-data", boost::bind(&createCallback, "/createst/createst/createst", _1));
+	zk.createEphemeralNode("/createst/createsten", "createsten-data", boost::bind(&createCallback, "/createst/createsten", _1));
+	zk.watchData("/testst", boost::bind(&dataCallback, _1, _2));
+	zk.watchChildren("/createst", boost::bind(&childrenCallback, _1, _2));
+
+	//
+	while(1)
+	{
+		runFor(zk, 1000);
+	}
+
+	return 0;
+}